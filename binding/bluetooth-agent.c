@@ -54,6 +54,85 @@ static const gchar introspection_xml[] =
 "   </interface>"
 "</node>";
 
+/*
+ * Pairing sessions are call work keyed by the device path, i.e.
+ * ("device", <path>, "RequestConfirmation"), so confirmations of
+ * different devices don't collide and each has its own timeout.
+ */
+
+/* NULL device_path is the most recent session */
+struct call_work *pairing_session_lookup_unlocked(struct bluetooth_state *ns,
+		const char *device_path)
+{
+	if (!device_path)
+		return ns->pairing_sessions ? ns->pairing_sessions->data : NULL;
+
+	return call_work_lookup_unlocked(ns, "device", device_path,
+			"RequestConfirmation");
+}
+
+void pairing_session_end_unlocked(struct call_work *cw)
+{
+	struct bluetooth_state *ns = cw->ns;
+
+	if (cw->agent_data.timeout)
+		g_source_remove(cw->agent_data.timeout);
+	cw->agent_data.timeout = 0;
+
+	ns->pairing_sessions = g_slist_remove(ns->pairing_sessions, cw);
+	call_work_destroy_unlocked(cw);
+}
+
+static void pairing_session_event(struct bluetooth_state *ns,
+		const char *action, const char *device_path)
+{
+	json_object *jev = json_object_new_object();
+
+	json_object_object_add(jev, "action", json_object_new_string(action));
+	if (device_path)
+		json_process_path(jev, device_path);
+
+	afb_event_push(ns->agent_event, jev);
+}
+
+struct pairing_timeout_data {
+	struct bluetooth_state *ns;
+	int id;
+};
+
+static gboolean pairing_session_timeout(gpointer user_data)
+{
+	struct pairing_timeout_data *ptd = user_data;
+	struct bluetooth_state *ns = ptd->ns;
+	struct call_work *cw;
+	gchar *device_path = NULL;
+
+	call_work_lock(ns);
+
+	/* the session may have ended, and its call work been reused */
+	cw = call_work_lookup_by_id_unlocked(ns, ptd->id);
+	if (cw && cw->agent_data.timeout &&
+	    !g_strcmp0(cw->method, "RequestConfirmation")) {
+		cw->agent_data.timeout = 0;
+
+		g_dbus_method_invocation_return_dbus_error(cw->invocation,
+				"org.bluez.Error.Rejected",
+				"Confirmation timed out");
+
+		device_path = g_strdup(cw->agent_data.device_path);
+		pairing_session_end_unlocked(cw);
+	}
+
+	call_work_unlock(ns);
+
+	if (device_path) {
+		pairing_session_event(ns, "canceled_pairing", device_path);
+		g_free(device_path);
+	}
+
+	return G_SOURCE_REMOVE;
+}
+
 static void handle_method_call(
 		GDBusConnection *connection,
 		const gchar *sender_name,
@@ -65,10 +144,13 @@ static void handle_method_call(
 		gpointer user_data)
 {
 	struct bluetooth_state *ns = user_data;
+	struct pairing_timeout_data *ptd;
 	struct call_work *cw;
 	GError *error = NULL;
 	json_object *jev = NULL;
 	const gchar *path = NULL;
+	gchar *device_path;
+	guint timeout;
 
 	/* AFB_INFO("sender=%s", sender_name);
 	AFB_INFO("object_path=%s", object_path);
@@ -78,21 +160,26 @@ static void handle_method_call(
 	if (!g_strcmp0(method_name, "RequestConfirmation")) {
 		int pin;
 
-		g_variant_get(parameters, "(ou)", &path, &pin);
+		g_variant_get(parameters, "(&ou)", &path, &pin);
 
 		call_work_lock(ns);
 
-		/* can only occur while a pair is issued */
-		cw = call_work_lookup_unlocked(ns, "device", NULL, "RequestConfirmation");
+		/* a new request for the same device supersedes the old one */
+		cw = pairing_session_lookup_unlocked(ns, path);
+		if (cw) {
+			g_dbus_method_invocation_return_dbus_error(
+					cw->invocation,
+					"org.bluez.Error.Canceled",
+					"Superseded by a new request");
+			pairing_session_end_unlocked(cw);
+		}
 
-		/* if nothing is pending return an error */
 		/* TODO: allow client side pairing */
-		if (!cw)
-			cw = call_work_create_unlocked(ns, "device", NULL,
+		cw = call_work_create_unlocked(ns, "device", path,
 				"RequestConfirmation", NULL, &error);
-
 		if (!cw) {
 			call_work_unlock(ns);
+			g_clear_error(&error);
 			g_dbus_method_invocation_return_dbus_error(invocation,
 					"org.bluez.Error.Rejected",
 					"No connection pending");
@@ -109,6 +196,19 @@ static void handle_method_call(
 		cw->agent_data.device_path = g_strdup(path);
 		cw->invocation = invocation;
 
+		timeout = g_atomic_int_get(&ns->pairing_timeout);
+		if (timeout) {
+			ptd = g_malloc0(sizeof(*ptd));
+			ptd->ns = ns;
+			ptd->id = cw->id;
+			cw->agent_data.timeout = g_timeout_add_full(
+					G_PRIORITY_DEFAULT, timeout,
+					pairing_session_timeout, ptd, g_free);
+		}
+
+		ns->pairing_sessions = g_slist_prepend(ns->pairing_sessions,
+				cw);
+
 		call_work_unlock(ns);
 
 		afb_event_push(ns->agent_event, jev);
@@ -130,8 +230,11 @@ static void handle_method_call(
 		
 		call_work_lock(ns);
 
-		/* can only occur while a pair is issued */
-		cw = call_work_lookup_unlocked(ns, "device", NULL, "RequestConfirmation");
+		/*
+		 * Cancel doesn't name the device; BlueZ has a single request
+		 * per agent outstanding, which is the most recent session.
+		 */
+		cw = pairing_session_lookup_unlocked(ns, NULL);
 
 		if (!cw) {
 			call_work_unlock(ns);
@@ -141,14 +244,14 @@ static void handle_method_call(
 			return;
 		}
 
-		jev = json_object_new_object();
-		json_object_object_add(jev, "action", json_object_new_string("canceled_pairing"));
+		device_path = g_strdup(cw->agent_data.device_path);
 
-		afb_event_push(ns->agent_event, jev);
-
-		call_work_destroy_unlocked(cw);
+		pairing_session_end_unlocked(cw);
 		call_work_unlock(ns);
 
+		pairing_session_event(ns, "canceled_pairing", device_path);
+		g_free(device_path);
+
 		return g_dbus_method_invocation_return_value(invocation, NULL);
 	}
 
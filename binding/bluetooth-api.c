@@ -60,61 +60,87 @@ void call_work_unlock(struct bluetooth_state *ns)
 
 static void mediaplayer1_set_path(struct bluetooth_state *ns, const char *path)
 {
-	if (ns->mediaplayer_path)
-		g_free(ns->mediaplayer_path);
+	gchar *old;
+
+	g_mutex_lock(&ns->mediaplayer_mutex);
+	old = ns->mediaplayer_path;
 	ns->mediaplayer_path = g_strdup(path);
+	g_mutex_unlock(&ns->mediaplayer_mutex);
+
+	g_free(old);
 }
 
-static void mediaplayer1_connect_disconnect(struct bluetooth_state *ns,
-				            const gchar *player, int state)
+static gchar *mediaplayer1_dup_path(struct bluetooth_state *ns)
 {
-	GVariant *reply;
-	gchar *path = g_strdup(player);
-	const char *uuids[] = { "0000110a-0000-1000-8000-00805f9b34fb", "0000110e-0000-1000-8000-00805f9b34fb", NULL };
-	const char **tmp = (const char **) uuids;
+	gchar *path;
 
-	*g_strrstr(path, "/") = '\0';
+	g_mutex_lock(&ns->mediaplayer_mutex);
+	path = g_strdup(ns->mediaplayer_path);
+	g_mutex_unlock(&ns->mediaplayer_mutex);
 
-	for (; *tmp; tmp++) {
-		reply = bluez_call(ns, "device", path, state ? "ConnectProfile" : "DisconnectProfile", g_variant_new("(&s)", *tmp), NULL);
-		if (!reply)
-			break;
-	}
+	return path;
+}
 
-	g_free(path);
+/*
+ * Pending call work is indexed twice: by id, and by the operation
+ * (access_type, type_arg, method) of which only one may be pending.
+ */
+static guint call_work_op_hash(gconstpointer key)
+{
+	const struct call_work *cw = key;
+	guint hash;
+
+	hash = cw->access_type ? g_str_hash(cw->access_type) : 0;
+	hash = hash * 31 + (cw->type_arg ? g_str_hash(cw->type_arg) : 0);
+	hash = hash * 31 + (cw->method ? g_str_hash(cw->method) : 0);
+
+	return hash;
 }
 
-struct call_work *call_work_lookup_unlocked(
-		struct bluetooth_state *ns,
-		const char *access_type, const char *type_arg,
-		const char *method)
+static gboolean call_work_op_equal(gconstpointer a, gconstpointer b)
+{
+	const struct call_work *cw_a = a, *cw_b = b;
+
+	return !g_strcmp0(cw_a->access_type, cw_b->access_type) &&
+	       !g_strcmp0(cw_a->type_arg, cw_b->type_arg) &&
+	       !g_strcmp0(cw_a->method, cw_b->method);
+}
+
+static void call_work_init(struct bluetooth_state *ns)
+{
+	g_mutex_init(&ns->cw_mutex);
+	ns->next_cw_id = 1;
+	ns->cw_by_id = g_hash_table_new(g_direct_hash, g_direct_equal);
+	ns->cw_by_op = g_hash_table_new(call_work_op_hash,
+			call_work_op_equal);
+}
+
+static void call_work_cleanup(struct bluetooth_state *ns)
 {
 	struct call_work *cw;
-	GSList *list;
 
-	/* we can only allow a single pending call */
-	for (list = ns->cw_pending; list; list = g_slist_next(list)) {
-		cw = list->data;
-		if (!g_strcmp0(access_type, cw->access_type) &&
-		    !g_strcmp0(type_arg, cw->type_arg) &&
-		    !g_strcmp0(method, cw->method))
-			return cw;
+	g_hash_table_destroy(ns->cw_by_op);
+	g_hash_table_destroy(ns->cw_by_id);
+
+	while ((cw = ns->cw_free)) {
+		ns->cw_free = cw->next_free;
+		g_free(cw);
 	}
-	return NULL;
 }
 
-struct call_work *call_work_lookup(
+struct call_work *call_work_lookup_unlocked(
 		struct bluetooth_state *ns,
 		const char *access_type, const char *type_arg,
 		const char *method)
 {
-	struct call_work *cw;
-
-	g_mutex_lock(&ns->cw_mutex);
-	cw = call_work_lookup_unlocked(ns, access_type, type_arg, method);
-	g_mutex_unlock(&ns->cw_mutex);
+	struct call_work key = {
+		.access_type	= access_type,
+		.type_arg	= (gchar *)type_arg,
+		.method		= method,
+	};
 
-	return cw;
+	/* we can only allow a single pending call */
+	return g_hash_table_lookup(ns->cw_by_op, &key);
 }
 
 int call_work_pending_id(
@@ -137,28 +163,7 @@ int call_work_pending_id(
 struct call_work *call_work_lookup_by_id_unlocked(
 		struct bluetooth_state *ns, int id)
 {
-	struct call_work *cw;
-	GSList *list;
-
-	/* we can only allow a single pending call */
-	for (list = ns->cw_pending; list; list = g_slist_next(list)) {
-		cw = list->data;
-		if (cw->id == id)
-			return cw;
-	}
-	return NULL;
-}
-
-struct call_work *call_work_lookup_by_id(
-		struct bluetooth_state *ns, int id)
-{
-	struct call_work *cw;
-
-	g_mutex_lock(&ns->cw_mutex);
-	cw = call_work_lookup_by_id_unlocked(ns, id);
-	g_mutex_unlock(&ns->cw_mutex);
-
-	return cw;
+	return g_hash_table_lookup(ns->cw_by_id, GINT_TO_POINTER(id));
 }
 
 struct call_work *call_work_create_unlocked(struct bluetooth_state *ns,
@@ -177,91 +182,799 @@ struct call_work *call_work_create_unlocked(struct bluetooth_state *ns,
 		return NULL;
 	}
 
-	/* no other pending; allocate */
-	cw = g_malloc0(sizeof(*cw));
+	/* no other pending; take one from the pool or allocate */
+	cw = ns->cw_free;
+	if (cw) {
+		ns->cw_free = cw->next_free;
+		ns->cw_free_count--;
+		memset(cw, 0, sizeof(*cw));
+	} else {
+		cw = g_malloc0(sizeof(*cw));
+	}
 	cw->ns = ns;
 	do {
 		cw->id = ns->next_cw_id;
 		if (++ns->next_cw_id < 0)
 			ns->next_cw_id = 1;
-	} while (call_work_lookup_by_id_unlocked(ns, cw->id));
+	} while (g_hash_table_contains(ns->cw_by_id,
+			GINT_TO_POINTER(cw->id)));
 
-	cw->access_type = g_strdup(access_type);
+	/* all but type_arg (a path) are from a small set of constants */
+	cw->access_type = g_intern_string(access_type);
 	cw->type_arg = g_strdup(type_arg);
-	cw->method = g_strdup(method);
-	cw->bluez_method = g_strdup(bluez_method);
+	cw->method = g_intern_string(method);
+	cw->bluez_method = g_intern_string(bluez_method);
+	cw->start_time = g_get_monotonic_time();
 
-	ns->cw_pending = g_slist_prepend(ns->cw_pending, cw);
+	g_hash_table_insert(ns->cw_by_id, GINT_TO_POINTER(cw->id), cw);
+	g_hash_table_insert(ns->cw_by_op, cw, cw);
 
 	return cw;
 }
 
-struct call_work *call_work_create(struct bluetooth_state *ns,
-		const char *access_type, const char *type_arg,
-		const char *method, const char *bluez_method,
-		GError **error)
+void call_work_destroy_unlocked(struct call_work *cw)
 {
+	struct bluetooth_state *ns = cw->ns;
+	struct call_work *cw2;
 
-	struct call_work *cw;
+	/* verify that it's something we know about */
+	cw2 = call_work_lookup_by_id_unlocked(ns, cw->id);
+	if (cw2 != cw) {
+		AFB_ERROR("Bad call work to destroy");
+		return;
+	}
+
+	/* remove it */
+	g_hash_table_remove(ns->cw_by_op, cw);
+	g_hash_table_remove(ns->cw_by_id, GINT_TO_POINTER(cw->id));
+
+	/* agent struct data */
+	g_free(cw->agent_data.device_path);
+
+	g_free(cw->type_arg);
+
+	if (ns->cw_free_count >= CALL_WORK_POOL_MAX) {
+		g_free(cw);
+		return;
+	}
+	cw->next_free = ns->cw_free;
+	ns->cw_free = cw;
+	ns->cw_free_count++;
+}
+
+void call_work_destroy(struct call_work *cw)
+{
+	struct bluetooth_state *ns = cw->ns;
 
 	g_mutex_lock(&ns->cw_mutex);
-	cw = call_work_create_unlocked(ns,
-			access_type, type_arg, method, bluez_method,
-			error);
+	call_work_destroy_unlocked(cw);
 	g_mutex_unlock(&ns->cw_mutex);
+}
 
-	return cw;
+/*
+ * Deadlines of the operations that may hang on an unresponsive device
+ * for the whole D-Bus timeout; the reaper cancels the call once one is
+ * exceeded, and asks BlueZ to abort where that is harmless.
+ */
+static const struct call_work_deadline {
+	const char *method;
+	guint timeout;			/* ms */
+	const char *abort_method;	/* on the device, after canceling */
+} call_work_deadlines[] = {
+	{ "connect_service",	30 * 1000,	NULL },
+	{ "disconnect_service",	10 * 1000,	NULL },
+	{ "pair_device",	60 * 1000,	"CancelPairing" },
+	{ "remove_device",	10 * 1000,	NULL },
+	{ "read_properties",	DBUS_REPLY_TIMEOUT_SHORT, NULL },
+};
+
+static const struct call_work_deadline *call_work_deadline(
+		struct call_work *cw)
+{
+	guint i;
+
+	for (i = 0; i < G_N_ELEMENTS(call_work_deadlines); i++) {
+		if (!strcmp(cw->method, call_work_deadlines[i].method))
+			return &call_work_deadlines[i];
+	}
+
+	return NULL;
 }
 
-void call_work_destroy_unlocked(struct call_work *cw)
+static void call_work_abort_callback(void *user_data,
+		GVariant *result, GError **error)
 {
-	struct bluetooth_state *ns = cw->ns;
-	struct call_work *cw2;
+	gchar *path = user_data;
 
-	/* verify that it's something we know about */
-	cw2 = call_work_lookup_by_id_unlocked(ns, cw->id);
-	if (cw2 != cw) {
-		AFB_ERROR("Bad call work to destroy");
+	if (error && *error)
+		AFB_DEBUG("abort on %s failed: %s", path, (*error)->message);
+	if (result)
+		g_variant_unref(result);
+	g_free(path);
+}
+
+/* queues (method, device path) pairs on aborts for call_work_abort() */
+static gboolean call_work_cancel_unlocked(struct call_work *cw,
+		const char *reason, GSList **aborts)
+{
+	const struct call_work_deadline *cwd;
+
+	/* agent sessions have no call; the callback destroys the cw */
+	if (cw->canceled || !cw->cpw)
+		return FALSE;
+
+	cw->canceled = TRUE;
+	bluez_cancel_call(cw->ns, cw->cpw, reason);
+
+	cwd = call_work_deadline(cw);
+	if (cwd && cwd->abort_method && cw->type_arg) {
+		*aborts = g_slist_prepend(*aborts, g_strdup(cw->type_arg));
+		*aborts = g_slist_prepend(*aborts, (gpointer)cwd->abort_method);
+	}
+
+	return TRUE;
+}
+
+/* don't hold the lock while asking BlueZ */
+static void call_work_abort(struct bluetooth_state *ns, GSList *aborts)
+{
+	const char *method;
+	GError *error = NULL;
+	GSList *l;
+	gchar *path;
+
+	for (l = aborts; l && l->next; l = l->next->next) {
+		method = l->data;
+		path = l->next->data;
+
+		if (!bluez_call_async(ns, BLUEZ_AT_DEVICE, path, method, NULL,
+				&error, call_work_abort_callback, path)) {
+			g_clear_error(&error);
+			g_free(path);
+		}
+	}
+	g_slist_free(aborts);
+}
+
+static gboolean call_work_reaper(gpointer user_data)
+{
+	struct bluetooth_state *ns = user_data;
+	const struct call_work_deadline *cwd;
+	GSList *aborts = NULL;
+	GHashTableIter iter;
+	struct call_work *cw;
+	gint64 now = g_get_monotonic_time();
+
+	call_work_lock(ns);
+	g_hash_table_iter_init(&iter, ns->cw_by_id);
+	while (g_hash_table_iter_next(&iter, NULL, (gpointer *)&cw)) {
+		cwd = call_work_deadline(cw);
+		if (!cwd || now - cw->start_time <
+				(gint64)cwd->timeout * G_TIME_SPAN_MILLISECOND)
+			continue;
+
+		if (call_work_cancel_unlocked(cw, "operation timed out",
+				&aborts))
+			AFB_INFO("%s %s timed out, canceled", cw->method,
+					cw->type_arg);
+	}
+	call_work_unlock(ns);
+
+	call_work_abort(ns, aborts);
+
+	return G_SOURCE_CONTINUE;
+}
+
+static afb_event_t get_event_from_value(struct bluetooth_state *ns,
+			const char *value)
+{
+	if (!g_strcmp0(value, "adapter_changes"))
+		return ns->adapter_changes_event;
+
+	if (!g_strcmp0(value, "device_changes"))
+		return ns->device_changes_event;
+
+	if (!g_strcmp0(value, "media"))
+		return ns->media_event;
+
+	if (!g_strcmp0(value, "agent"))
+		return ns->agent_event;
+
+	return NULL;
+}
+
+/*
+ * Whether anyone listens to an event: bumped (never 0) after every
+ * subscribe, and reset to 0 when a push reaches nobody unless a subscribe
+ * happened meanwhile. Lets the signal handlers skip building JSON nobody
+ * will receive.
+ */
+static gint *event_listened(struct bluetooth_state *ns, afb_event_t event)
+{
+	if (event == ns->adapter_changes_event)
+		return &ns->adapter_changes_listened;
+	if (event == ns->device_changes_event)
+		return &ns->device_changes_listened;
+	if (event == ns->media_event)
+		return &ns->media_listened;
+
+	return NULL;
+}
+
+static gboolean bluetooth_event_listened(struct bluetooth_state *ns,
+		afb_event_t event)
+{
+	gint *listened = event_listened(ns, event);
+
+	return !listened || g_atomic_int_get(listened) != 0;
+}
+
+static void bluetooth_event_subscribed(struct bluetooth_state *ns,
+		afb_event_t event)
+{
+	gint *listened = event_listened(ns, event);
+
+	if (listened && g_atomic_int_add(listened, 1) == -1)
+		g_atomic_int_inc(listened);
+}
+
+static void bluetooth_event_push(struct bluetooth_state *ns,
+		afb_event_t event, json_object *jresp)
+{
+	gint *listened = event_listened(ns, event);
+	gint gen = listened ? g_atomic_int_get(listened) : 0;
+
+	if (afb_event_push(event, jresp) == 0 && gen)
+		g_atomic_int_compare_and_exchange(listened, gen, 0);
+}
+
+/*
+ * Per-interface signal handling; the signal and interface names are
+ * interned as quarks once at init so every signal is routed with a
+ * couple of integer compares instead of string compares per property.
+ */
+struct bluez_signal_interface {
+	const char *interface;
+	const char *access_type;
+	json_object *(*changed)(struct bluetooth_state *ns,
+			const struct bluez_signal_interface *si,
+			const struct bluez_path *bp, GVariant *changed,
+			afb_event_t *event);
+	const struct property_info *pi;
+	GQuark quark;
+};
+
+struct bluez_signal {
+	const char *name;
+	json_object *(*handler)(struct bluetooth_state *ns,
+			const gchar *object_path, GVariant *parameters,
+			afb_event_t *event);
+	GQuark quark;
+};
+
+/*
+ * a{sv} -> properties of jprop, skipping the (D-Bus) property skip;
+ * returns the number of known properties
+ */
+static int bluez_signal_properties(const struct bluez_signal_interface *si,
+		json_object *jprop, const gchar *path, GVariant *props,
+		const gchar *skip)
+{
+	const gchar *key = NULL;
+	GVariant *var = NULL;
+	gboolean is_config;
+	GVariantIter array;
+	int cnt = 0;
+
+	g_variant_iter_init(&array, props);
+	while (g_variant_iter_next(&array, "{&sv}", &key, &var)) {
+		if (skip && !strcmp(key, skip))
+			;
+		else if (root_property_dbus2json(jprop, si->pi, key, var, &is_config))
+			cnt++;
+		else
+			AFB_DEBUG("%s property %s - unknown %s property",
+					path, key, si->access_type);
+		g_variant_unref(var);
+	}
+
+	return cnt;
+}
+
+/*
+ * device_changes coalescing
+ *
+ * While discovering, BlueZ sends RSSI/TxPower updates for every advertiser
+ * several times a second. When a window is configured, the changes of a
+ * device are merged (latest value wins) and sent as one event when the
+ * window expires. Everything here runs in the main loop thread.
+ */
+struct device_changes_pending {
+	struct bluetooth_state *ns;
+	gchar *path;
+	json_object *jresp;
+	guint timeout;
+};
+
+static void device_changes_pending_free(gpointer data)
+{
+	struct device_changes_pending *dcp = data;
+
+	if (dcp->timeout)
+		g_source_remove(dcp->timeout);
+	json_object_put(dcp->jresp);
+	g_free(dcp->path);
+	g_free(dcp);
+}
+
+/* send the merged changes of a device, if any */
+static void device_changes_flush(struct bluetooth_state *ns, const gchar *path)
+{
+	struct device_changes_pending *dcp;
+	json_object *jresp;
+
+	dcp = g_hash_table_lookup(ns->device_changes_pending, path);
+	if (!dcp)
+		return;
+
+	jresp = dcp->jresp;
+	dcp->jresp = NULL;
+	g_hash_table_remove(ns->device_changes_pending, path);
+
+	bluetooth_event_push(ns, ns->device_changes_event, jresp);
+}
+
+static gboolean device_changes_timeout(gpointer user_data)
+{
+	struct device_changes_pending *dcp = user_data;
+
+	dcp->timeout = 0;
+	device_changes_flush(dcp->ns, dcp->path);
+
+	return G_SOURCE_REMOVE;
+}
+
+/* takes ownership of jresp */
+static void device_changes_defer(struct bluetooth_state *ns,
+		const gchar *path, json_object *jresp, guint window)
+{
+	struct device_changes_pending *dcp;
+	json_object *jprop, *jpending;
+
+	dcp = g_hash_table_lookup(ns->device_changes_pending, path);
+	if (!dcp) {
+		dcp = g_malloc0(sizeof(*dcp));
+		dcp->ns = ns;
+		dcp->path = g_strdup(path);
+		dcp->jresp = jresp;
+		dcp->timeout = g_timeout_add(window,
+				device_changes_timeout, dcp);
+		g_hash_table_insert(ns->device_changes_pending,
+				dcp->path, dcp);
 		return;
 	}
 
-	/* remove it */
-	ns->cw_pending = g_slist_remove(ns->cw_pending, cw);
+	json_object_object_get_ex(jresp, "properties", &jprop);
+	json_object_object_get_ex(dcp->jresp, "properties", &jpending);
+
+	json_object_object_foreach(jprop, key, val)
+		json_object_object_add(jpending, key, json_object_get(val));
+
+	json_object_put(jresp);
+}
+
+/*
+ * RSSI hysteresis/rate limit: an RSSI change is only reported when it moved
+ * at least rssi_threshold dBm and rssi_interval ms passed since the last
+ * reported value of the device. Main loop thread only.
+ */
+struct rssi_reported {
+	gint16 rssi;
+	gint64 time;
+};
+
+/* returns TRUE when the RSSI of a{sv} changed should not be reported */
+static gboolean rssi_filtered(struct bluetooth_state *ns,
+		const gchar *path, GVariant *changed)
+{
+	gint threshold = g_atomic_int_get(&ns->rssi_threshold);
+	gint interval = g_atomic_int_get(&ns->rssi_interval);
+	struct rssi_reported *rr;
+	gint64 now;
+	gint16 rssi;
+
+	if (threshold <= 0 && interval <= 0)
+		return FALSE;
+
+	if (!g_variant_lookup(changed, "RSSI", "n", &rssi))
+		return FALSE;
+
+	now = g_get_monotonic_time();
+
+	rr = g_hash_table_lookup(ns->rssi_reported, path);
+	if (rr) {
+		if (ABS(rssi - rr->rssi) < threshold)
+			return TRUE;
+		if (now - rr->time < (gint64)interval * G_TIME_SPAN_MILLISECOND)
+			return TRUE;
+	} else {
+		rr = g_malloc0(sizeof(*rr));
+		g_hash_table_insert(ns->rssi_reported, g_strdup(path), rr);
+	}
+
+	rr->rssi = rssi;
+	rr->time = now;
+
+	return FALSE;
+}
+
+/* the "changed" event of an adapter or device, NULL if nothing known */
+static json_object *bluez_changed_json(const struct bluez_signal_interface *si,
+		const struct bluez_path *bp, GVariant *changed,
+		const gchar *skip)
+{
+	json_object *jresp, *jobj;
+
+	jobj = json_object_new_object();
+
+	// NOTE: Possible to get a changed property for something we don't care about
+	if (!bluez_signal_properties(si, jobj, bp->path, changed, skip)) {
+		json_object_put(jobj);
+		return NULL;
+	}
+
+	jresp = json_object_new_object();
+	json_process_bluez_path(jresp, bp);
+	json_object_object_add(jresp, "action",
+			json_object_new_string("changed"));
+	json_object_object_add(jresp, "properties", jobj);
+
+	return jresp;
+}
+
+static json_object *bluez_changed_adapter(struct bluetooth_state *ns,
+		const struct bluez_signal_interface *si,
+		const struct bluez_path *bp, GVariant *changed,
+		afb_event_t *event)
+{
+	*event = ns->adapter_changes_event;
+	if (!bluetooth_event_listened(ns, *event))
+		return NULL;
+
+	return bluez_changed_json(si, bp, changed, NULL);
+}
+
+static json_object *bluez_changed_device(struct bluetooth_state *ns,
+		const struct bluez_signal_interface *si,
+		const struct bluez_path *bp, GVariant *changed,
+		afb_event_t *event)
+{
+	const gchar *skip = NULL;
+	GVariant *connected;
+	json_object *jresp;
+	gint window;
+
+	/* regardless of listeners, autoconnect tracks connections */
+	bluetooth_autoconnect_changed(ns, bp->path, changed);
+
+	*event = ns->device_changes_event;
+	if (!bluetooth_event_listened(ns, *event))
+		return NULL;
+
+	/* drop small/frequent RSSI moves before any JSON is built */
+	if (rssi_filtered(ns, bp->path, changed)) {
+		if (g_variant_n_children(changed) == 1)
+			return NULL;
+		skip = "RSSI";
+	}
+
+	jresp = bluez_changed_json(si, bp, changed, skip);
+	if (!jresp)
+		return NULL;
+
+	window = g_atomic_int_get(&ns->device_changes_window);
+	if (window <= 0)
+		return jresp;
+
+	/* connection state changes are never delayed */
+	connected = g_variant_lookup_value(changed, "Connected", NULL);
+	if (connected) {
+		g_variant_unref(connected);
+		device_changes_flush(ns, bp->path);
+		return jresp;
+	}
+
+	device_changes_defer(ns, bp->path, jresp, window);
+
+	return NULL;
+}
+
+static json_object *bluez_changed_media(struct bluetooth_state *ns,
+		const struct bluez_signal_interface *si,
+		const struct bluez_path *bp, GVariant *changed,
+		afb_event_t *event)
+{
+	json_object *jresp;
+
+	*event = ns->media_event;
+	if (!bluetooth_event_listened(ns, *event))
+		return NULL;
+
+	jresp = json_object_new_object();
+
+	// NOTE: Possible to get a changed property for something we don't care about
+	if (!bluez_signal_properties(si, jresp, bp->path, changed, NULL)) {
+		json_object_put(jresp);
+		return NULL;
+	}
+
+	json_process_bluez_path(jresp, bp);
+
+	if (!strcmp(si->access_type, BLUEZ_AT_MEDIAPLAYER)) {
+		json_object_object_add(jresp, "type",
+			json_object_new_string("playback"));
+	} else {
+		json_object_object_add(jresp, "action",
+			json_object_new_string("changed"));
+		json_object_object_add(jresp, "type",
+			json_object_new_string("transport"));
+		json_object_object_add(jresp, "endpoint",
+			bluez_path_component_json(bp, BLUEZ_PATH_LEAF));
+	}
+
+	return jresp;
+}
+
+static struct bluez_signal_interface bluez_signal_interfaces[] = {
+	{
+		.interface	= BLUEZ_ADAPTER_INTERFACE,
+		.access_type	= BLUEZ_AT_ADAPTER,
+		.changed	= bluez_changed_adapter,
+	}, {
+		.interface	= BLUEZ_DEVICE_INTERFACE,
+		.access_type	= BLUEZ_AT_DEVICE,
+		.changed	= bluez_changed_device,
+	}, {
+		.interface	= BLUEZ_MEDIAPLAYER_INTERFACE,
+		.access_type	= BLUEZ_AT_MEDIAPLAYER,
+		.changed	= bluez_changed_media,
+	}, {
+		.interface	= BLUEZ_MEDIATRANSPORT_INTERFACE,
+		.access_type	= BLUEZ_AT_MEDIATRANSPORT,
+		.changed	= bluez_changed_media,
+	},
+};
+
+static const struct bluez_signal_interface *bluez_signal_interface_lookup(
+		const gchar *interface)
+{
+	GQuark quark = g_quark_try_string(interface);
+	guint i;
+
+	if (!quark)
+		return NULL;
+
+	for (i = 0; i < G_N_ELEMENTS(bluez_signal_interfaces); i++) {
+		if (bluez_signal_interfaces[i].quark == quark)
+			return &bluez_signal_interfaces[i];
+	}
+
+	return NULL;
+}
+
+/* the event an InterfacesAdded/InterfacesRemoved of path is reported on */
+static afb_event_t bluez_path_event(struct bluetooth_state *ns,
+		const struct bluez_path *bp)
+{
+	if (bluez_path_is_mediatransport(bp) || bluez_path_is_mediaplayer(bp))
+		return ns->media_event;
+	if (bp->n == BLUEZ_PATH_ADAPTER + 1)
+		return ns->adapter_changes_event;
+
+	return ns->device_changes_event;
+}
+
+static json_object *bluez_interfaces_added(struct bluetooth_state *ns,
+		const gchar *object_path, GVariant *parameters,
+		afb_event_t *event)
+{
+	const struct bluez_signal_interface *si;
+	json_object *jresp = NULL, *jobj;
+	GVariantIter *array = NULL;
+	const gchar *path = NULL;
+	const gchar *key = NULL;
+	gboolean found = FALSE;
+	struct bluez_path bp;
+	GVariant *var;
+
+	g_variant_get(parameters, "(&oa{sa{sv}})", &path, &array);
+
+	var = g_variant_get_child_value(parameters, 1);
+	bluez_cache_interfaces_added(ns, path, var);
+	g_variant_unref(var);
+
+	// no adapter or device in path
+	if (!g_strcmp0(path, BLUEZ_PATH)) {
+		g_variant_iter_free(array);
+		return NULL;
+	}
+
+	bluez_path_parse(&bp, path);
+
+	/* a (re)announced device is in range, see autoconnect */
+	if (bp.n == BLUEZ_PATH_DEVICE + 1)
+		bluetooth_autoconnect_sighted(ns, path);
+
+	*event = bluez_path_event(ns, &bp);
+	if (!bluetooth_event_listened(ns, *event)) {
+		if (bluez_path_is_mediaplayer(&bp))
+			mediaplayer1_set_path(ns, path);
+		g_variant_iter_free(array);
+		return NULL;
+	}
+
+	jobj = json_object_new_object();
+
+	while (g_variant_iter_next(array, "{&s@a{sv}}", &key, &var)) {
+		si = bluez_signal_interface_lookup(key);
+
+		/* media players are announced below without properties */
+		if (si && strcmp(si->access_type, BLUEZ_AT_MEDIAPLAYER)) {
+			found = TRUE;
+			bluez_signal_properties(si, jobj, path, var, NULL);
+		}
+		g_variant_unref(var);
+	}
+	g_variant_iter_free(array);
+
+	if (found) {
+		jresp = json_object_new_object();
+		json_process_bluez_path(jresp, &bp);
+		json_object_object_add(jresp, "action",
+			json_object_new_string("added"));
+
+		if (bluez_path_is_mediatransport(&bp)) {
+			json_object_object_add(jresp, "type",
+				json_object_new_string("transport"));
+			json_object_object_add(jresp, "endpoint",
+				bluez_path_component_json(&bp, BLUEZ_PATH_LEAF));
+		}
+		json_object_object_add(jresp, "properties", jobj);
+		return jresp;
+	}
+
+	json_object_put(jobj);
 
-	/* agent struct data */
-	g_free(cw->agent_data.device_path);
+	if (bluez_path_is_mediaplayer(&bp)) {
+		jresp = json_object_new_object();
+		json_process_bluez_path(jresp, &bp);
+		json_object_object_add(jresp, "connected",
+			json_object_new_boolean(TRUE));
+		json_object_object_add(jresp, "type",
+			json_object_new_string("playback"));
+		json_object_object_add(jresp, "player",
+			bluez_path_component_json(&bp, BLUEZ_PATH_LEAF));
+		mediaplayer1_set_path(ns, path);
+	}
 
-	g_free(cw->access_type);
-	g_free(cw->type_arg);
-	g_free(cw->method);
-	g_free(cw->bluez_method);
+	return jresp;
 }
 
-void call_work_destroy(struct call_work *cw)
+static json_object *bluez_interfaces_removed(struct bluetooth_state *ns,
+		const gchar *object_path, GVariant *parameters,
+		afb_event_t *event)
 {
-	struct bluetooth_state *ns = cw->ns;
+	const gchar *path = NULL;
+	struct bluez_path bp;
+	json_object *jresp;
+	GVariant *var;
 
-	g_mutex_lock(&ns->cw_mutex);
-	call_work_destroy_unlocked(cw);
-	g_mutex_unlock(&ns->cw_mutex);
+	g_variant_get_child(parameters, 0, "&o", &path);
+
+	var = g_variant_get_child_value(parameters, 1);
+	bluez_cache_interfaces_removed(ns, path, var);
+	g_variant_unref(var);
+
+	/* send whatever is pending before the removal */
+	device_changes_flush(ns, path);
+	g_hash_table_remove(ns->rssi_reported, path);
+
+	bluez_path_parse(&bp, path);
+
+	*event = bluez_path_event(ns, &bp);
+	if (!bluetooth_event_listened(ns, *event))
+		return NULL;
+
+	jresp = json_object_new_object();
+	json_process_bluez_path(jresp, &bp);
+
+	if (bluez_path_is_mediatransport(&bp)) {
+		json_object_object_add(jresp, "type",
+			json_object_new_string("transport"));
+		json_object_object_add(jresp, "action",
+			json_object_new_string("removed"));
+		json_object_object_add(jresp, "endpoint",
+			bluez_path_component_json(&bp, BLUEZ_PATH_LEAF));
+	} else if (bluez_path_is_mediaplayer(&bp)) {
+		json_object_object_add(jresp, "connected",
+			json_object_new_boolean(FALSE));
+		json_object_object_add(jresp, "type",
+			json_object_new_string("playback"));
+		json_object_object_add(jresp, "player",
+			bluez_path_component_json(&bp, BLUEZ_PATH_LEAF));
+	/* adapter removal */
+	} else if (bp.n == BLUEZ_PATH_ADAPTER + 1) {
+		json_object_object_add(jresp, "action",
+			json_object_new_string("removed"));
+	/* device removal */
+	} else if (bp.n == BLUEZ_PATH_DEVICE + 1) {
+		json_object_object_add(jresp, "action",
+			json_object_new_string("removed"));
+	} else {
+		json_object_put(jresp);
+		jresp = NULL;
+	}
+
+	return jresp;
 }
 
-static afb_event_t get_event_from_value(struct bluetooth_state *ns,
-			const char *value)
+static json_object *bluez_properties_changed(struct bluetooth_state *ns,
+		const gchar *object_path, GVariant *parameters,
+		afb_event_t *event)
 {
-	if (!g_strcmp0(value, "adapter_changes"))
-		return ns->adapter_changes_event;
+	const struct bluez_signal_interface *si;
+	GVariant *changed, *invalidated;
+	json_object *jresp = NULL;
+	const gchar *interface;
+	struct bluez_path bp;
+
+	g_variant_get_child(parameters, 0, "&s", &interface);
+	changed = g_variant_get_child_value(parameters, 1);
+	invalidated = g_variant_get_child_value(parameters, 2);
+
+	bluez_cache_properties_changed(ns, object_path, interface,
+			changed, invalidated);
+
+	/* route once per signal, not once per property */
+	si = bluez_signal_interface_lookup(interface);
+	if (si) {
+		bluez_path_parse(&bp, object_path);
+		jresp = si->changed(ns, si, &bp, changed, event);
+	}
 
-	if (!g_strcmp0(value, "device_changes"))
-		return ns->device_changes_event;
+	g_variant_unref(invalidated);
+	g_variant_unref(changed);
 
-	if (!g_strcmp0(value, "media"))
-		return ns->media_event;
+	return jresp;
+}
 
-	if (!g_strcmp0(value, "agent"))
-		return ns->agent_event;
+static struct bluez_signal bluez_signals[] = {
+	{
+		.name		= "InterfacesAdded",
+		.handler	= bluez_interfaces_added,
+	}, {
+		.name		= "InterfacesRemoved",
+		.handler	= bluez_interfaces_removed,
+	}, {
+		.name		= "PropertiesChanged",
+		.handler	= bluez_properties_changed,
+	},
+};
 
-	return NULL;
+static void bluez_signal_init(void)
+{
+	struct bluez_signal_interface *si;
+	guint i;
+
+	for (i = 0; i < G_N_ELEMENTS(bluez_signals); i++)
+		bluez_signals[i].quark =
+			g_quark_from_static_string(bluez_signals[i].name);
+
+	for (i = 0; i < G_N_ELEMENTS(bluez_signal_interfaces); i++) {
+		si = &bluez_signal_interfaces[i];
+		si->quark = g_quark_from_static_string(si->interface);
+		si->pi = bluez_get_property_info(si->access_type, NULL);
+	}
 }
 
 static void bluez_devices_signal_callback(
@@ -274,248 +987,124 @@ static void bluez_devices_signal_callback(
 	gpointer user_data)
 {
 	struct bluetooth_state *ns = user_data;
-	GVariantIter *array1 = NULL;
-	GError *error = NULL;
-	GVariant *var = NULL;
-	const gchar *path = NULL;
-	const gchar *key = NULL;
-	json_object *jresp = NULL, *jobj;
-	GVariantIter *array = NULL;
-	gboolean is_config, ret;
 	afb_event_t event = ns->device_changes_event;
+	GQuark quark = g_quark_try_string(signal_name);
+	json_object *jresp = NULL;
+	guint i;
 
 	/* AFB_INFO("sender=%s", sender_name);
 	AFB_INFO("object_path=%s", object_path);
 	AFB_INFO("interface=%s", interface_name);
 	AFB_INFO("signal=%s", signal_name); */
 
-	if (!g_strcmp0(signal_name, "InterfacesAdded")) {
-
-		g_variant_get(parameters, "(&oa{sa{sv}})", &path, &array);
-
-		// no adapter or device in path
-		if (!g_strcmp0(path, BLUEZ_PATH))
-			return;
-
-		jresp = json_object_new_object();
-
-                json_process_path(jresp, path);
-
-		jobj = json_object_new_object();
-
-		while (g_variant_iter_next(array, "{&s@a{sv}}", &key, &var)) {
-			const char *name = NULL;
-			GVariant *val = NULL;
-
-			if (g_strcmp0(key, BLUEZ_DEVICE_INTERFACE) &&
-			    g_strcmp0(key, BLUEZ_MEDIATRANSPORT_INTERFACE) &&
-			    g_strcmp0(key, BLUEZ_ADAPTER_INTERFACE))
-				continue;
-
-			array1 = g_variant_iter_new(var);
-
-			while (g_variant_iter_next(array1, "{&sv}", &name, &val)) {
-				if (!g_strcmp0(key, BLUEZ_DEVICE_INTERFACE)) {
-					ret = device_property_dbus2json(jobj,
-						name, val, &is_config, &error);
-				} else if (!g_strcmp0(key, BLUEZ_MEDIATRANSPORT_INTERFACE)) {
-					ret = mediatransport_property_dbus2json(jobj,
-						name, val, &is_config, &error);
-				} else if (!g_strcmp0(key, BLUEZ_ADAPTER_INTERFACE)) {
-					ret = adapter_property_dbus2json(jobj,
-						name, val, &is_config, &error);
-					event = ns->adapter_changes_event;
-				} else {
-					ret = TRUE;
-				}
-
-				g_variant_unref(val);
-				if (!ret) {
-					AFB_DEBUG("%s property %s - %s",
-							path,
-							key, error->message);
-					g_clear_error(&error);
-				}
-			}
-			g_variant_iter_free(array1);
-		}
-		g_variant_iter_free(array);
-
-		if (array1) {
-			json_object_object_add(jresp, "action",
-				json_object_new_string("added"));
-
-			if (is_mediatransport1_interface(path)) {
-				gchar *endpoint = find_index(path, 5);
-				json_object_object_add(jresp, "type",
-					json_object_new_string("transport"));
-				json_object_object_add(jresp, "endpoint",
-					json_object_new_string(endpoint));
-				g_free(endpoint);
+	if (!quark)
+		return;
 
-				event = ns->media_event;
-			}
-			json_object_object_add(jresp, "properties", jobj);
-		} else if (is_mediaplayer1_interface(path)) {
-			gchar *player = find_index(path, 5);
-			json_object_object_add(jresp, "connected",
-				json_object_new_boolean(TRUE));
-			json_object_object_add(jresp, "type",
-				json_object_new_string("playback"));
-			json_object_object_add(jresp, "player",
-				json_object_new_string(player));
-			mediaplayer1_set_path(ns, path);
-			event = ns->media_event;
-		} else {
-			json_object_put(jresp);
-			jresp = NULL;
+	for (i = 0; i < G_N_ELEMENTS(bluez_signals); i++) {
+		if (bluez_signals[i].quark == quark) {
+			jresp = bluez_signals[i].handler(ns, object_path,
+					parameters, &event);
+			break;
 		}
+	}
 
-	} else if (!g_strcmp0(signal_name, "InterfacesRemoved")) {
+	if (jresp)
+		bluetooth_event_push(ns, event, jresp);
+}
 
-		g_variant_get(parameters, "(&oas)", &path, &array);
-		g_variant_iter_free(array);
+static void bluez_signal_unsubscribe(struct bluetooth_state *ns)
+{
+	guint i;
 
-		jresp = json_object_new_object();
-		json_process_path(jresp, path);
+	for (i = 0; i < BLUEZ_SIGNAL_SUBS; i++) {
+		if (ns->device_sub[i])
+			g_dbus_connection_signal_unsubscribe(ns->conn,
+					ns->device_sub[i]);
+		ns->device_sub[i] = 0;
+	}
+}
 
-		if (is_mediatransport1_interface(path)) {
-			gchar *endpoint = find_index(path, 5);
-			json_object_object_add(jresp, "type",
-				json_object_new_string("transport"));
-			json_object_object_add(jresp, "action",
-				json_object_new_string("removed"));
-			json_object_object_add(jresp, "endpoint",
-				json_object_new_string(endpoint));
-			g_free(endpoint);
-
-			event = ns->media_event;
-		} else if (is_mediaplayer1_interface(path)) {
-			gchar *player = find_index(path, 5);
-			json_object_object_add(jresp, "connected",
-				json_object_new_boolean(FALSE));
-			json_object_object_add(jresp, "type",
-				json_object_new_string("playback"));
-			json_object_object_add(jresp, "player",
-				json_object_new_string(player));
-			event = ns->media_event;
-		/* adapter removal */
-		} else if (split_length(path) == 4) {
-			json_object_object_add(jresp, "action",
-				json_object_new_string("removed"));
-			event = ns->adapter_changes_event;
-		/* device removal */
-		} else if (split_length(path) == 5) {
-			json_object_object_add(jresp, "action",
-				json_object_new_string("removed"));
-		} else {
-			json_object_put(jresp);
-			jresp = NULL;
+/*
+ * Let dbus-daemon do the filtering: only the ObjectManager signals and
+ * the PropertiesChanged signals of the interfaces we have tables for are
+ * routed to us, so GATT, MediaItem etc. traffic never wakes us up.
+ */
+static gboolean bluez_signal_subscribe(struct bluetooth_state *ns)
+{
+	static const char * const om_signals[] = {
+		"InterfacesAdded",
+		"InterfacesRemoved",
+	};
+	guint i, n = 0;
+
+	G_STATIC_ASSERT(G_N_ELEMENTS(om_signals) +
+			G_N_ELEMENTS(bluez_signal_interfaces) ==
+			BLUEZ_SIGNAL_SUBS);
+
+	for (i = 0; i < G_N_ELEMENTS(om_signals); i++)
+		ns->device_sub[n++] = g_dbus_connection_signal_subscribe(
+				ns->conn,
+				BLUEZ_SERVICE,
+				FREEDESKTOP_OBJECTMANAGER,
+				om_signals[i],
+				BLUEZ_OBJECT_PATH,
+				NULL,	/* arg0 */
+				G_DBUS_SIGNAL_FLAGS_NONE,
+				bluez_devices_signal_callback,
+				ns,
+				NULL);
+
+	for (i = 0; i < G_N_ELEMENTS(bluez_signal_interfaces); i++)
+		ns->device_sub[n++] = g_dbus_connection_signal_subscribe(
+				ns->conn,
+				BLUEZ_SERVICE,
+				FREEDESKTOP_PROPERTIES,
+				"PropertiesChanged",
+				NULL,	/* object path */
+				bluez_signal_interfaces[i].interface,
+				G_DBUS_SIGNAL_FLAGS_NONE,
+				bluez_devices_signal_callback,
+				ns,
+				NULL);
+
+	for (i = 0; i < BLUEZ_SIGNAL_SUBS; i++) {
+		if (!ns->device_sub[i]) {
+			bluez_signal_unsubscribe(ns);
+			return FALSE;
 		}
+	}
 
-	} else if (!g_strcmp0(signal_name, "PropertiesChanged")) {
-
-		g_variant_get(parameters, "(&sa{sv}as)", &path, &array, &array1);
-
-		if (!g_strcmp0(path, BLUEZ_DEVICE_INTERFACE) ||
-		    !g_strcmp0(path, BLUEZ_ADAPTER_INTERFACE)) {
-			int cnt = 0;
-
-			jresp = json_object_new_object();
-
-			json_process_path(jresp, object_path);
-			json_object_object_add(jresp, "action",
-					json_object_new_string("changed"));
-
-			jobj = json_object_new_object();
-
-			while (g_variant_iter_next(array, "{&sv}", &key, &var)) {
-				if (!g_strcmp0(path, BLUEZ_DEVICE_INTERFACE)) {
-					ret = device_property_dbus2json(jobj,
-						key, var, &is_config, &error);
-					event = ns->device_changes_event;
-				} else {
-					ret = adapter_property_dbus2json(jobj,
-						key, var, &is_config, &error);
-					event = ns->adapter_changes_event;
-				}
-				g_variant_unref(var);
-				if (!ret) {
-					AFB_DEBUG("%s property %s - %s",
-							"devices",
-							key, error->message);
-					g_clear_error(&error);
-					continue;
-				}
-				cnt++;
-			}
-
-			// NOTE: Possible to get a changed property for something we don't care about
-			if (cnt > 0) {
-				json_object_object_add(jresp, "properties", jobj);
-			} else {
-				json_object_put(jobj);
-				json_object_put(jresp);
-				jresp = NULL;
-			}
-
-		} else if (!g_strcmp0(path, BLUEZ_MEDIAPLAYER_INTERFACE) ||
-			   !g_strcmp0(path, BLUEZ_MEDIATRANSPORT_INTERFACE)) {
-			int cnt = 0;
-			jresp = json_object_new_object();
-			json_process_path(jresp, object_path);
-
-			while (g_variant_iter_next(array, "{&sv}", &key, &var)) {
-				if (!g_strcmp0(path, BLUEZ_MEDIAPLAYER_INTERFACE))
-					ret = mediaplayer_property_dbus2json(jresp,
-						key, var, &is_config, &error);
-				else
-					ret = mediatransport_property_dbus2json(jresp,
-						key, var, &is_config, &error);
-				g_variant_unref(var);
-				if (!ret) {
-					AFB_DEBUG("%s property %s - %s",
-							path,
-							key, error->message);
-					g_clear_error(&error);
-					continue;
-				}
-				cnt++;
-			}
+	return TRUE;
+}
 
-			if (!g_strcmp0(path, BLUEZ_MEDIAPLAYER_INTERFACE)) {
-				json_object_object_add(jresp, "type",
-					json_object_new_string("playback"));
-			} else {
-				gchar *endpoint = find_index(object_path, 5);
-				json_object_object_add(jresp, "action",
-					json_object_new_string("changed"));
-				json_object_object_add(jresp, "type",
-					json_object_new_string("transport"));
-				json_object_object_add(jresp, "endpoint",
-					json_object_new_string(endpoint));
-				g_free(endpoint);
-			}
+static void bluez_name_appeared(GDBusConnection *connection,
+		const gchar *name, const gchar *name_owner,
+		gpointer user_data)
+{
+	struct bluetooth_state *ns = user_data;
+	GError *error = NULL;
 
-			// NOTE: Possible to get a changed property for something we don't care about
-			if (!cnt) {
-				json_object_put(jresp);
-				jresp = NULL;
-			}
+	/* already seeded at init time */
+	if (bluez_cache_is_valid(ns))
+		return;
 
-			event = ns->media_event;
-		}
+	AFB_INFO("%s appeared - reloading object cache", name);
 
-		g_variant_iter_free(array);
-		g_variant_iter_free(array1);
+	if (!bluez_cache_seed(ns, &error)) {
+		AFB_ERROR("Unable to seed object cache: %s",
+				BLUEZ_ERRMSG(error));
+		g_clear_error(&error);
 	}
+}
 
-	if (jresp) {
-		afb_event_push(event, jresp);
-		jresp = NULL;
-	}
+static void bluez_name_vanished(GDBusConnection *connection,
+		const gchar *name, gpointer user_data)
+{
+	struct bluetooth_state *ns = user_data;
 
-	json_object_put(jresp);
+	AFB_INFO("%s vanished - dropping object cache", name);
+
+	bluez_cache_clear(ns);
 }
 
 static struct bluetooth_state *bluetooth_init(GMainLoop *loop)
@@ -561,26 +1150,38 @@ static struct bluetooth_state *bluetooth_init(GMainLoop *loop)
 		goto err_no_events;
 	}
 
-	ns->device_sub = g_dbus_connection_signal_subscribe(
-			ns->conn,
-			BLUEZ_SERVICE,
-			NULL,   /* interface */
-			NULL,	/* member */
-			NULL,	/* object path */
-			NULL,	/* arg0 */
-			G_DBUS_SIGNAL_FLAGS_NONE,
-			bluez_devices_signal_callback,
-			ns,
-			NULL);
-	if (!ns->device_sub) {
+	bluez_property_index_init();
+	bluez_signal_init();
+
+	if (!bluez_signal_subscribe(ns)) {
 		AFB_ERROR("Unable to subscribe to interface signals");
 		goto err_no_device_sub;
 	}
 
-	g_mutex_init(&ns->cw_mutex);
-	ns->next_cw_id = 1;
+	call_work_init(ns);
+	bluez_call_pool_init(ns);
+	ns->cw_reaper = g_timeout_add_seconds(CALL_WORK_REAPER_INTERVAL,
+			call_work_reaper, ns);
+	g_mutex_init(&ns->mediaplayer_mutex);
+	g_mutex_init(&ns->default_adapter_mutex);
+
+	ns->device_changes_pending = g_hash_table_new_full(g_str_hash,
+			g_str_equal, NULL, device_changes_pending_free);
+	ns->rssi_reported = g_hash_table_new_full(g_str_hash, g_str_equal,
+			g_free, g_free);
+
+	/* signals are only dispatched once the loop runs, so none are lost */
+	bluez_cache_init(ns);
+	if (!bluez_cache_seed(ns, &error)) {
+		AFB_WARNING("Unable to seed object cache: %s",
+				BLUEZ_ERRMSG(error));
+		g_clear_error(&error);
+	}
 
-	g_timeout_add_seconds(5, bluetooth_autoconnect, ns);
+	ns->bluez_watch = g_bus_watch_name_on_connection(ns->conn,
+			BLUEZ_SERVICE, G_BUS_NAME_WATCHER_FLAGS_NONE,
+			bluez_name_appeared, bluez_name_vanished,
+			ns, NULL);
 
 	return ns;
 
@@ -596,7 +1197,18 @@ err_no_ns:
 
 static void bluetooth_cleanup(struct bluetooth_state *ns)
 {
-	g_dbus_connection_signal_unsubscribe(ns->conn, ns->device_sub);
+	if (ns->bluez_watch)
+		g_bus_unwatch_name(ns->bluez_watch);
+	if (ns->cache_objects)
+		bluez_cache_cleanup(ns);
+	bluez_signal_unsubscribe(ns);
+	bluetooth_autoconnect_free(ns);
+	g_hash_table_destroy(ns->device_changes_pending);
+	g_hash_table_destroy(ns->rssi_reported);
+	if (ns->cw_reaper)
+		g_source_remove(ns->cw_reaper);
+	call_work_cleanup(ns);
+	bluez_call_pool_cleanup(ns);
 	g_dbus_connection_close(ns->conn, NULL, NULL, NULL);
 	g_free(ns);
 }
@@ -654,10 +1266,27 @@ err_no_loop:
 	return NULL;
 }
 
+/* BlueZ adapter names are hciN */
+static gboolean adapter_name_valid(const char *adapter)
+{
+	const char *s;
+
+	if (!g_str_has_prefix(adapter, "hci") || !adapter[3])
+		return FALSE;
+
+	for (s = adapter + 3; *s; s++) {
+		if (!g_ascii_isdigit(*s))
+			return FALSE;
+	}
+
+	return TRUE;
+}
+
 static int init(afb_api_t api)
 {
 	struct init_data init_data, *id = &init_data;
 	json_object *args = NULL;
+	gchar *adapter;
 	gint64 end_time;
 	int ret;
 
@@ -710,27 +1339,93 @@ static int init(afb_api_t api)
 	else
 		AFB_INFO("bluetooth-binding operational");
 
-	id->ns->default_adapter = get_default_adapter(id->api);
+	adapter = get_default_adapter(id->api);
+	if (!adapter_name_valid(adapter)) {
+		AFB_WARNING("Invalid default adapter %s, using %s", adapter,
+				BLUEZ_DEFAULT_ADAPTER);
+		g_free(adapter);
+		adapter = g_strdup(BLUEZ_DEFAULT_ADAPTER);
+	}
+	g_atomic_pointer_set(&id->ns->default_adapter,
+			(gpointer)g_intern_string(adapter));
+	g_free(adapter);
+	g_atomic_int_set(&id->ns->device_changes_window,
+			get_conf_uint(id->api, "device_changes_window",
+				DEVICE_CHANGES_WINDOW_DEFAULT));
+	g_atomic_int_set(&id->ns->rssi_threshold,
+			get_conf_uint(id->api, "rssi_threshold",
+				RSSI_THRESHOLD_DEFAULT));
+	g_atomic_int_set(&id->ns->rssi_interval,
+			get_conf_uint(id->api, "rssi_interval",
+				RSSI_INTERVAL_DEFAULT));
+	g_atomic_int_set(&id->ns->connect_concurrency,
+			get_conf_uint(id->api, "connect_concurrency",
+				CONNECT_CONCURRENCY_DEFAULT));
+	g_atomic_int_set(&id->ns->pairing_timeout,
+			get_conf_uint(id->api, "pairing_timeout",
+				PAIRING_TIMEOUT_DEFAULT));
+
+	if (!id->rc)
+		bluetooth_autoconnect_start(id->ns, id->api);
 
 	return id->rc;
 }
 
-static void mediaplayer1_send_event(struct bluetooth_state *ns)
+struct mediaplayer1_event_work {
+	struct bluetooth_state *ns;
+	gchar *player;
+};
+
+static void mediaplayer1_send_event_callback(void *user_data,
+		GVariant *result, GError **error)
 {
-	gchar *player = g_strdup(ns->mediaplayer_path);
-	json_object *jresp = mediaplayer_properties(ns, NULL, player);
+	struct mediaplayer1_event_work *mew = user_data;
+	struct bluetooth_state *ns = mew->ns;
+	json_object *jresp;
+
+	if (!result) {
+		AFB_DEBUG("mediaplayer %s GetAll error %s", mew->player,
+				BLUEZ_ERRMSG(*error));
+		goto out_free;
+	}
 
+	jresp = bluez_properties_json(BLUEZ_AT_MEDIAPLAYER, result, NULL);
+	g_variant_unref(result);
 	if (!jresp)
-		goto out_err;
+		goto out_free;
 
-	json_process_path(jresp, player);
+	json_process_path(jresp, mew->player);
 	json_object_object_add(jresp, "connected",
 			json_object_new_boolean(TRUE));
 
-	afb_event_push(ns->media_event, jresp);
+	bluetooth_event_push(ns, ns->media_event, jresp);
+
+out_free:
+	g_free(mew->player);
+	g_free(mew);
+}
+
+static void mediaplayer1_send_event(struct bluetooth_state *ns)
+{
+	struct mediaplayer1_event_work *mew;
+	GError *error = NULL;
+	gchar *player;
+
+	player = mediaplayer1_dup_path(ns);
+	if (!player)
+		return;
+
+	mew = g_malloc0(sizeof(*mew));
+	mew->ns = ns;
+	mew->player = player;
 
-out_err:
-	g_free(player);
+	/* media players are not cached, fetch the state in the background */
+	if (!bluez_get_properties_async(ns, BLUEZ_AT_MEDIAPLAYER, mew->player,
+			&error, mediaplayer1_send_event_callback, mew)) {
+		g_clear_error(&error);
+		g_free(mew->player);
+		g_free(mew);
+	}
 }
 
 static void bluetooth_subscribe_unsubscribe(afb_req_t request,
@@ -758,6 +1453,8 @@ static void bluetooth_subscribe_unsubscribe(afb_req_t request,
 
 	if (!unsub) {
 		rc = afb_req_subscribe(request, event);
+		if (!rc)
+			bluetooth_event_subscribed(ns, event);
 
 		if (!g_strcmp0(value, "media"))
 			mediaplayer1_send_event(ns);
@@ -772,110 +1469,457 @@ static void bluetooth_subscribe_unsubscribe(afb_req_t request,
 		return;
 	}
 
-	afb_req_success_f(request, jresp, "Bluetooth %s to event \"%s\"",
-			!unsub ? "subscribed" : "unsubscribed",
-			value);
+	afb_req_success_f(request, jresp, "Bluetooth %s to event \"%s\"",
+			!unsub ? "subscribed" : "unsubscribed",
+			value);
+}
+
+static void bluetooth_subscribe(afb_req_t request)
+{
+	bluetooth_subscribe_unsubscribe(request, FALSE);
+}
+
+static void bluetooth_unsubscribe(afb_req_t request)
+{
+	bluetooth_subscribe_unsubscribe(request, TRUE);
+}
+
+/*
+ * Reads are answered from the object cache; on a miss they go to BlueZ
+ * asynchronously, and identical reads (same access type and path) that
+ * arrive meanwhile are attached to the pending call as waiters. All of
+ * them get the same reply, converted once.
+ */
+static const char *read_properties_info(const char *access_type)
+{
+	if (!strcmp(access_type, BLUEZ_AT_OBJECT))
+		return "Bluetooth - managed objects";
+	if (!strcmp(access_type, BLUEZ_AT_ADAPTER))
+		return "Bluetooth - adapter state";
+
+	return "Bluetooth - properties";
+}
+
+static void read_properties_callback(void *user_data,
+		GVariant *result, GError **error)
+{
+	struct call_work *cw = user_data;
+	struct bluetooth_state *ns = cw->ns;
+	const char *info = read_properties_info(cw->access_type);
+	json_object *jresp = NULL;
+	gchar *errmsg = NULL;
+	GSList *waiters, *l;
+
+	if (result) {
+		if (!strcmp(cw->access_type, BLUEZ_AT_OBJECT))
+			jresp = bluez_objects_json(result);
+		else
+			jresp = bluez_properties_json(cw->access_type,
+					result, error);
+		g_variant_unref(result);
+	} else if (error && *error) {
+		g_dbus_error_strip_remote_error(*error);
+	}
+
+	if (!jresp) {
+		errmsg = g_strdup_printf("%s %s error %s", cw->access_type,
+				cw->type_arg, error && *error ?
+					(*error)->message : "unspecified");
+	}
+
+	/* once off the pending list no more waiters can attach */
+	call_work_lock(ns);
+	waiters = g_slist_prepend(cw->waiters, cw->request);
+	cw->waiters = NULL;
+	call_work_destroy_unlocked(cw);
+	call_work_unlock(ns);
+
+	for (l = waiters; l; l = g_slist_next(l)) {
+		afb_req_t request = l->data;
+
+		/* the last one gets the original, the others a copy */
+		if (jresp)
+			afb_req_success(request, l->next ?
+					json_object_copy(jresp) : jresp, info);
+		else
+			afb_req_fail(request, "failed", errmsg);
+		afb_req_unref(request);
+	}
+	g_slist_free(waiters);
+
+	g_free(errmsg);
+}
+
+static void bluetooth_read_properties(afb_req_t request,
+		const char *access_type, const char *path)
+{
+	struct bluetooth_state *ns = bluetooth_get_userdata(request);
+	const char *info = read_properties_info(access_type);
+	gboolean objects = !strcmp(access_type, BLUEZ_AT_OBJECT);
+	GError *error = NULL;
+	struct call_work *cw;
+	json_object *jresp;
+
+	if (objects)
+		jresp = bluez_cache_get_objects(ns);
+	else
+		jresp = bluez_cache_get_properties(ns, access_type, path);
+	if (jresp) {
+		afb_req_success(request, jresp, info);
+		return;
+	}
+
+	call_work_lock(ns);
+
+	cw = call_work_lookup_unlocked(ns, access_type, path,
+			"read_properties");
+	if (cw) {
+		cw->waiters = g_slist_prepend(cw->waiters,
+				afb_req_addref(request));
+		call_work_unlock(ns);
+		return;
+	}
+
+	cw = call_work_create_unlocked(ns, access_type, path,
+			"read_properties",
+			objects ? "GetManagedObjects" : "GetAll", &error);
+	if (!cw) {
+		call_work_unlock(ns);
+		afb_req_fail_f(request, "failed", "can't queue work %s",
+				error->message);
+		g_error_free(error);
+		return;
+	}
+
+	cw->request = afb_req_addref(request);
+
+	/* issued with the lock held, the callback needs it to complete */
+	if (objects)
+		cw->cpw = bluez_get_objects_async(ns, &error,
+				read_properties_callback, cw);
+	else
+		cw->cpw = bluez_get_properties_async(ns, access_type, path,
+				&error, read_properties_callback, cw);
+
+	if (!cw->cpw) {
+		call_work_destroy_unlocked(cw);
+		call_work_unlock(ns);
+
+		afb_req_fail_f(request, "failed", "%s %s error %s",
+				access_type, path, BLUEZ_ERRMSG(error));
+		g_clear_error(&error);
+		afb_req_unref(request);
+		return;
+	}
+
+	call_work_unlock(ns);
+}
+
+static void bluetooth_list(afb_req_t request)
+{
+	bluetooth_read_properties(request, BLUEZ_AT_OBJECT, BLUEZ_OBJECT_PATH);
+}
+
+/*
+ * adapter_state issues its sub-operations as concurrent async calls and
+ * joins the results into a single reply. Powering on goes first (nothing
+ * else works on a powered off adapter) and powering off goes last; the
+ * rest is sent together, filter before discovery, since BlueZ handles
+ * the calls of a connection in order. The reply carries the adapter
+ * properties as read once everything is done.
+ */
+enum adapter_state_op {
+	ADAPTER_STATE_POWERED,
+	ADAPTER_STATE_FILTER,
+	ADAPTER_STATE_DISCOVERY,
+	ADAPTER_STATE_DISCOVERABLE,
+	ADAPTER_STATE_OPS,
+};
+
+enum adapter_state_phase {
+	ADAPTER_STATE_POWER_ON,
+	ADAPTER_STATE_CONFIGURE,
+	ADAPTER_STATE_POWER_OFF,
+	ADAPTER_STATE_DONE,
+};
+
+/* request field of each operation, also the key of its error */
+static const char * const adapter_state_fields[ADAPTER_STATE_OPS] = {
+	[ADAPTER_STATE_POWERED]		= "powered",
+	[ADAPTER_STATE_FILTER]		= "filter",
+	[ADAPTER_STATE_DISCOVERY]	= "discovery",
+	[ADAPTER_STATE_DISCOVERABLE]	= "discoverable",
+};
+
+struct adapter_state_work {
+	struct bluetooth_state *ns;
+	afb_req_t request;
+	gchar *adapter;
+	int phase;
+	gint pending;
+	const char *scan;
+	const char *discoverable;
+	const char *powered;
+	GVariant *filter;	/* SetDiscoveryFilter parameters */
+	/* one writer each, only read once all calls are done */
+	gchar *errors[ADAPTER_STATE_OPS];
+};
+
+struct adapter_state_call {
+	struct adapter_state_work *asw;
+	enum adapter_state_op op;
+};
+
+static void adapter_state_free(struct adapter_state_work *asw)
+{
+	int i;
+
+	afb_req_unref(asw->request);
+	if (asw->filter)
+		g_variant_unref(asw->filter);
+	for (i = 0; i < ADAPTER_STATE_OPS; i++)
+		g_free(asw->errors[i]);
+	g_free(asw->adapter);
+	g_free(asw);
+}
+
+static void adapter_state_set_error(struct adapter_state_work *asw,
+		enum adapter_state_op op, GError *error)
+{
+	switch (op) {
+	case ADAPTER_STATE_DISCOVERY:
+		asw->errors[op] = g_strdup_printf(
+				"adapter %s method %s error %s",
+				asw->adapter, str2boolean(asw->scan) ?
+					"StartDiscovery" : "StopDiscovery",
+				BLUEZ_ERRMSG(error));
+		break;
+	case ADAPTER_STATE_DISCOVERABLE:
+	case ADAPTER_STATE_POWERED:
+		asw->errors[op] = g_strdup_printf(
+				"adapter %s set_property %s error %s",
+				asw->adapter,
+				op == ADAPTER_STATE_POWERED ?
+					"Powered" : "Discoverable",
+				BLUEZ_ERRMSG(error));
+		break;
+	default:
+		asw->errors[op] = g_strdup_printf(
+				"adapter %s SetDiscoveryFilter error %s",
+				asw->adapter, BLUEZ_ERRMSG(error));
+		break;
+	}
+}
+
+/* the resulting adapter properties, read once all changes are done */
+static void adapter_state_reply_callback(void *user_data,
+		GVariant *result, GError **error)
+{
+	struct adapter_state_work *asw = user_data;
+	json_object *jresp = NULL, *jerrors = NULL;
+	int i, failed = 0;
+
+	if (result) {
+		jresp = bluez_properties_json(BLUEZ_AT_ADAPTER, result, error);
+		g_variant_unref(result);
+	} else if (error && *error) {
+		g_dbus_error_strip_remote_error(*error);
+	}
+
+	if (!jresp) {
+		afb_req_fail_f(asw->request, "failed", "property %s error %s",
+				"State", error && *error ?
+					(*error)->message : "unspecified");
+		adapter_state_free(asw);
+		return;
+	}
+
+	for (i = 0; i < ADAPTER_STATE_OPS; i++) {
+		if (!asw->errors[i])
+			continue;
+		if (!jerrors)
+			jerrors = json_object_new_object();
+		json_object_object_add(jerrors, adapter_state_fields[i],
+				json_object_new_string(asw->errors[i]));
+		failed++;
+	}
+
+	if (!failed) {
+		afb_req_success(asw->request, jresp,
+				"Bluetooth - adapter state");
+	} else {
+		json_object_object_add(jresp, "errors", jerrors);
+		afb_req_reply_f(asw->request, jresp, "failed",
+				"adapter %s - %d operation(s) failed",
+				asw->adapter, failed);
+	}
+
+	adapter_state_free(asw);
 }
 
-static void bluetooth_subscribe(afb_req_t request)
+static void adapter_state_reply(struct adapter_state_work *asw)
 {
-	bluetooth_subscribe_unsubscribe(request, FALSE);
-}
+	struct bluez_pending_work *cpw;
+	GError *error = NULL;
 
-static void bluetooth_unsubscribe(afb_req_t request)
-{
-	bluetooth_subscribe_unsubscribe(request, TRUE);
+	cpw = bluez_get_properties_async(asw->ns, BLUEZ_AT_ADAPTER,
+			asw->adapter, &error, adapter_state_reply_callback, asw);
+	if (!cpw) {
+		afb_req_fail_f(asw->request, "failed", "property %s error %s",
+				"State", BLUEZ_ERRMSG(error));
+		g_clear_error(&error);
+		adapter_state_free(asw);
+	}
 }
 
-static void bluetooth_list(afb_req_t request)
+static void adapter_state_run(struct adapter_state_work *asw);
+
+/* called once per call, and once by adapter_state_run for its guard */
+static void adapter_state_put(struct adapter_state_work *asw)
 {
-	struct bluetooth_state *ns = bluetooth_get_userdata(request);
-	GError *error = NULL;
-	json_object *jresp;
+	if (!g_atomic_int_dec_and_test(&asw->pending))
+		return;
 
-	jresp = object_properties(ns, &error);
+	/* nothing else works on an adapter that failed to power on */
+	if (asw->errors[ADAPTER_STATE_POWERED])
+		asw->phase = ADAPTER_STATE_DONE;
+	else
+		asw->phase++;
+
+	if (asw->phase < ADAPTER_STATE_DONE) {
+		adapter_state_run(asw);
+		return;
+	}
 
-	afb_req_success(request, jresp, "Bluetooth - managed objects");
+	adapter_state_reply(asw);
 }
 
-static void bluetooth_state(afb_req_t request)
+static void adapter_state_callback(void *user_data,
+		GVariant *result, GError **error)
 {
-	struct bluetooth_state *ns = bluetooth_get_userdata(request);
-	GError *error = NULL;
-	json_object *jresp;
-	const char *adapter = afb_req_value(request, "adapter");
-
-	adapter = BLUEZ_ROOT_PATH(adapter ? adapter : ns->default_adapter);
+	struct adapter_state_call *asc = user_data;
+	struct adapter_state_work *asw = asc->asw;
 
-	jresp = adapter_properties(ns, &error, adapter);
-	if (!jresp) {
-		afb_req_fail_f(request, "failed", "property %s error %s",
-				"State", BLUEZ_ERRMSG(error));
-		return;
+	if (error && *error) {
+		g_dbus_error_strip_remote_error(*error);
+		adapter_state_set_error(asw, asc->op, *error);
 	}
 
-	afb_req_success(request, jresp, "Bluetooth - adapter state");
+	if (result)
+		g_variant_unref(result);
+
+	g_free(asc);
+	adapter_state_put(asw);
 }
 
-static void bluetooth_adapter(afb_req_t request)
+static void adapter_state_call(struct adapter_state_work *asw,
+		enum adapter_state_op op)
 {
-	struct bluetooth_state *ns = bluetooth_get_userdata(request);
+	struct bluetooth_state *ns = asw->ns;
+	struct bluez_pending_work *cpw = NULL;
+	struct adapter_state_call *asc;
 	GError *error = NULL;
-	const char *adapter = afb_req_value(request, "adapter");
-	const char *scan, *discoverable, *powered, *filter, *transport;
 
-	adapter = BLUEZ_ROOT_PATH(adapter ? adapter : ns->default_adapter);
-
-	scan = afb_req_value(request, "discovery");
-	if (scan) {
-		GVariant *reply = adapter_call(ns, adapter, str2boolean(scan) ?
-				"StartDiscovery" : "StopDiscovery", NULL, &error);
+	asc = g_malloc0(sizeof(*asc));
+	asc->asw = asw;
+	asc->op = op;
+
+	g_atomic_int_inc(&asw->pending);
+
+	switch (op) {
+	case ADAPTER_STATE_POWERED:
+		cpw = bluez_set_property_async(ns, BLUEZ_AT_ADAPTER,
+				asw->adapter, FALSE, "Powered",
+				json_object_new_boolean(str2boolean(asw->powered)),
+				&error, adapter_state_callback, asc);
+		break;
+	case ADAPTER_STATE_FILTER:
+		cpw = bluez_call_async(ns, BLUEZ_AT_ADAPTER,
+				asw->adapter, "SetDiscoveryFilter",
+				asw->filter, &error,
+				adapter_state_callback, asc);
+		break;
+	case ADAPTER_STATE_DISCOVERY:
+		cpw = bluez_call_async(ns, BLUEZ_AT_ADAPTER,
+				asw->adapter, str2boolean(asw->scan) ?
+				"StartDiscovery" : "StopDiscovery",
+				NULL, &error,
+				adapter_state_callback, asc);
+		break;
+	case ADAPTER_STATE_DISCOVERABLE:
+		cpw = bluez_set_property_async(ns, BLUEZ_AT_ADAPTER,
+				asw->adapter, FALSE, "Discoverable",
+				json_object_new_boolean(
+					str2boolean(asw->discoverable)),
+				&error, adapter_state_callback, asc);
+		break;
+	default:
+		break;
+	}
 
-		if (!reply) {
-			afb_req_fail_f(request, "failed",
-					"adapter %s method %s error %s",
-					scan, "Scan", BLUEZ_ERRMSG(error));
-			g_error_free(error);
-			return;
-		}
-		g_variant_unref(reply);
+	if (!cpw) {
+		adapter_state_set_error(asw, op, error);
+		g_clear_error(&error);
+		g_free(asc);
+		adapter_state_put(asw);
 	}
+}
 
-	discoverable = afb_req_value(request, "discoverable");
-	if (discoverable) {
-		int ret = adapter_set_property(ns, adapter, FALSE, "Discoverable",
-				json_object_new_boolean(str2boolean(discoverable)),
-				&error);
-		if (!ret) {
-			afb_req_fail_f(request, "failed",
-					"adapter %s set_property %s error %s",
-					adapter, "Discoverable", BLUEZ_ERRMSG(error));
-			g_error_free(error);
-			return;
-		}
+static void adapter_state_run(struct adapter_state_work *asw)
+{
+	gboolean power_on = asw->powered && str2boolean(asw->powered);
+
+	/* guard, so the phase can't complete while still issuing calls */
+	g_atomic_int_set(&asw->pending, 1);
+
+	switch (asw->phase) {
+	case ADAPTER_STATE_POWER_ON:
+		if (power_on)
+			adapter_state_call(asw, ADAPTER_STATE_POWERED);
+		break;
+	case ADAPTER_STATE_CONFIGURE:
+		if (asw->filter)
+			adapter_state_call(asw, ADAPTER_STATE_FILTER);
+		if (asw->scan)
+			adapter_state_call(asw, ADAPTER_STATE_DISCOVERY);
+		if (asw->discoverable)
+			adapter_state_call(asw, ADAPTER_STATE_DISCOVERABLE);
+		break;
+	case ADAPTER_STATE_POWER_OFF:
+		if (asw->powered && !power_on)
+			adapter_state_call(asw, ADAPTER_STATE_POWERED);
+		break;
 	}
 
-	powered = afb_req_value(request, "powered");
-	if (powered) {
-		int ret = adapter_set_property(ns, adapter, FALSE, "Powered",
-				json_object_new_boolean(str2boolean(powered)),
-				&error);
+	adapter_state_put(asw);
+}
 
-		if (!ret) {
-			afb_req_fail_f(request, "failed",
-					"adapter %s set_property %s error %s",
-					adapter, "Powered", BLUEZ_ERRMSG(error));
-			g_error_free(error);
-			return;
-		}
-	}
+static void bluetooth_adapter(afb_req_t request)
+{
+	struct bluetooth_state *ns = bluetooth_get_userdata(request);
+	const char *adapter = afb_req_value(request, "adapter");
+	struct adapter_state_work *asw;
+	const char *filter, *transport;
+	GVariant *flt = NULL;
+
+	adapter = BLUEZ_ROOT_PATH(adapter ? adapter :
+			bluetooth_get_default_adapter(ns));
 
 	filter = afb_req_value(request, "filter");
 	transport = afb_req_value(request, "transport");
 
+	/* plain state reads share any identical read in flight */
+	if (!filter && !transport &&
+	    !afb_req_value(request, "discovery") &&
+	    !afb_req_value(request, "discoverable") &&
+	    !afb_req_value(request, "powered")) {
+		bluetooth_read_properties(request, BLUEZ_AT_ADAPTER, adapter);
+		return;
+	}
+
+	/* validate everything before anything is changed */
 	if (filter || transport) {
 		GVariantBuilder builder;
-		GVariant *flt, *reply;
 
 		g_variant_builder_init(&builder, G_VARIANT_TYPE("a{sv}"));
 
@@ -884,6 +1928,8 @@ static void bluetooth_adapter(afb_req_t request)
 			gchar **uuid = NULL;
 
 			if (json_object_get_type(jobj) != json_type_array) {
+				json_object_put(jobj);
+				g_variant_builder_clear(&builder);
 				afb_req_fail_f(request, "failed", "invalid discovery filter");
 				return;
 			}
@@ -893,6 +1939,7 @@ static void bluetooth_adapter(afb_req_t request)
 					      g_variant_new_strv((const gchar * const *) uuid, -1));
 
 			g_strfreev(uuid);
+			json_object_put(jobj);
 		}
 
 		if (transport) {
@@ -901,42 +1948,51 @@ static void bluetooth_adapter(afb_req_t request)
 
 		}
 
-		flt = g_variant_builder_end(&builder);
-
-		reply = adapter_call(ns, adapter, "SetDiscoveryFilter",
-				     g_variant_new("(@a{sv})", flt), &error);
+		flt = g_variant_ref_sink(g_variant_new("(@a{sv})",
+					g_variant_builder_end(&builder)));
+	}
 
+	asw = g_malloc0(sizeof(*asw));
+	asw->ns = ns;
+	asw->request = request;
+	asw->adapter = g_strdup(adapter);
+	asw->phase = ADAPTER_STATE_POWER_ON;
+	asw->scan = afb_req_value(request, "discovery");
+	asw->discoverable = afb_req_value(request, "discoverable");
+	asw->powered = afb_req_value(request, "powered");
+	asw->filter = flt;
 
-		if (!reply) {
-			afb_req_fail_f(request, "failed",
-					"adapter %s SetDiscoveryFilter error %s",
-					adapter, BLUEZ_ERRMSG(error));
-			g_error_free(error);
-			return;
-		}
-		g_variant_unref(reply);
-	}
+	afb_req_addref(request);
 
-	bluetooth_state(request);
+	adapter_state_run(asw);
 }
 
 static void bluetooth_default_adapter(afb_req_t request)
 {
 	struct bluetooth_state *ns = bluetooth_get_userdata(request);
 	const char *adapter = afb_req_value(request, "adapter");
-	json_object *jresp = json_object_new_object();
+	json_object *jresp;
 
-	call_work_lock(ns);
+	/* interned strings are never freed, so only take real names */
+	if (adapter && !adapter_name_valid(adapter)) {
+		afb_req_fail_f(request, "failed", "Invalid adapter %s",
+				adapter);
+		return;
+	}
+
+	jresp = json_object_new_object();
+
+	/* readers never take this lock, they only see the pointer swap */
 	if (adapter) {
+		g_mutex_lock(&ns->default_adapter_mutex);
+		g_atomic_pointer_set(&ns->default_adapter,
+				(gpointer)g_intern_string(adapter));
 		set_default_adapter(afb_req_get_api(request), adapter);
-
-		if (ns->default_adapter)
-			g_free(ns->default_adapter);
-		ns->default_adapter = g_strdup(adapter);
+		g_mutex_unlock(&ns->default_adapter_mutex);
 	}
 
-	json_object_object_add(jresp, "adapter", json_object_new_string(ns->default_adapter));
-	call_work_unlock(ns);
+	json_object_object_add(jresp, "adapter",
+			json_object_new_string(bluetooth_get_default_adapter(ns)));
 
 	afb_req_success(request, jresp, "Bluetooth - default adapter");
 }
@@ -984,9 +2040,12 @@ static void bluetooth_connect_device(afb_req_t request)
 	/* optional, connect single profile */
 	uuid = afb_req_value(request, "uuid");
 
-	cw = call_work_create(ns, "device", device,
+	call_work_lock(ns);
+
+	cw = call_work_create_unlocked(ns, "device", device,
 			"connect_service", "Connect", &error);
 	if (!cw) {
+		call_work_unlock(ns);
 		afb_req_fail_f(request, "failed", "can't queue work %s",
 				error->message);
 		g_error_free(error);
@@ -996,6 +2055,7 @@ static void bluetooth_connect_device(afb_req_t request)
 	cw->request = request;
 	afb_req_addref(request);
 
+	/* issued with the lock held, the callback needs it to complete */
 	if (uuid)
 		cw->cpw = bluez_call_async(ns, "device", device,
 			"ConnectProfile", g_variant_new("(&s)", uuid), &error,
@@ -1006,25 +2066,360 @@ static void bluetooth_connect_device(afb_req_t request)
 			connect_service_callback, cw);
 
 	if (!cw->cpw) {
+		call_work_destroy_unlocked(cw);
+		call_work_unlock(ns);
 		afb_req_fail_f(request, "failed", "connection error %s",
 				error->message);
-		call_work_destroy(cw);
+		afb_req_unref(request);
 		g_error_free(error);
-		/* fall-thru */
+		goto out_free;
 	}
 
+	call_work_unlock(ns);
+
 out_free:
 	g_free(device);
 
 }
 
+/*
+ * connect_devices connects a list of devices with at most "concurrency"
+ * Connect calls in flight; every completion starts the next device and
+ * is reported as a device_changes "connect_result" event right away.
+ */
+struct connect_devices_work;
+
+struct connect_devices_entry {
+	struct connect_devices_work *cdw;
+	gchar *device;		/* as requested */
+	gchar *path;
+	gchar *uuid;
+	struct call_work *cw;
+	gchar *error;		/* one writer, read once all are done */
+};
+
+struct connect_devices_work {
+	struct bluetooth_state *ns;
+	afb_req_t request;
+	gint pending;
+	gint next;
+	guint n_entries;
+	struct connect_devices_entry *entries;
+};
+
+static void connect_devices_free(struct connect_devices_work *cdw)
+{
+	guint i;
+
+	for (i = 0; i < cdw->n_entries; i++) {
+		g_free(cdw->entries[i].device);
+		g_free(cdw->entries[i].path);
+		g_free(cdw->entries[i].uuid);
+		g_free(cdw->entries[i].error);
+	}
+	afb_req_unref(cdw->request);
+	g_free(cdw->entries);
+	g_free(cdw);
+}
+
+static json_object *connect_devices_result(struct connect_devices_entry *cde)
+{
+	json_object *jresp = json_object_new_object();
+	struct bluez_path bp;
+
+	if (cde->path) {
+		bluez_path_parse(&bp, cde->path);
+		json_process_bluez_path(jresp, &bp);
+	} else {
+		json_object_object_add(jresp, "device",
+				json_object_new_string(cde->device));
+	}
+	if (cde->uuid)
+		json_object_object_add(jresp, "uuid",
+				json_object_new_string(cde->uuid));
+	json_object_object_add(jresp, "success",
+			json_object_new_boolean(!cde->error));
+	if (cde->error)
+		json_object_object_add(jresp, "error",
+				json_object_new_string(cde->error));
+
+	return jresp;
+}
+
+static void connect_devices_report(struct connect_devices_entry *cde)
+{
+	struct bluetooth_state *ns = cde->cdw->ns;
+	json_object *jresp;
+
+	if (!bluetooth_event_listened(ns, ns->device_changes_event))
+		return;
+
+	jresp = connect_devices_result(cde);
+	json_object_object_add(jresp, "action",
+			json_object_new_string("connect_result"));
+
+	bluetooth_event_push(ns, ns->device_changes_event, jresp);
+}
+
+static void connect_devices_put(struct connect_devices_work *cdw)
+{
+	json_object *jresp, *jresults;
+	guint i, failed = 0;
+
+	if (!g_atomic_int_dec_and_test(&cdw->pending))
+		return;
+
+	jresults = json_object_new_array();
+	for (i = 0; i < cdw->n_entries; i++) {
+		json_object_array_add(jresults,
+				connect_devices_result(&cdw->entries[i]));
+		if (cdw->entries[i].error)
+			failed++;
+	}
+
+	jresp = json_object_new_object();
+	json_object_object_add(jresp, "results", jresults);
+
+	if (!failed)
+		afb_req_success_f(cdw->request, jresp,
+				"Bluetooth - %u devices connected",
+				cdw->n_entries);
+	else
+		afb_req_reply_f(cdw->request, jresp, "failed",
+				"%u of %u devices failed to connect",
+				failed, cdw->n_entries);
+
+	connect_devices_free(cdw);
+}
+
+static void connect_devices_callback(void *user_data,
+		GVariant *result, GError **error);
+
+static gboolean connect_devices_start(struct connect_devices_entry *cde)
+{
+	struct bluetooth_state *ns = cde->cdw->ns;
+	GError *error = NULL;
+
+	if (cde->error)
+		return FALSE;
+
+	call_work_lock(ns);
+
+	cde->cw = call_work_create_unlocked(ns, "device", cde->path,
+			"connect_service", "Connect", &error);
+	if (!cde->cw) {
+		call_work_unlock(ns);
+		goto out_error;
+	}
+
+	/* issued with the lock held, the callback needs it to complete */
+	if (cde->uuid)
+		cde->cw->cpw = bluez_call_async(ns, "device", cde->path,
+			"ConnectProfile", g_variant_new("(s)", cde->uuid),
+			&error, connect_devices_callback, cde);
+	else
+		cde->cw->cpw = bluez_call_async(ns, "device", cde->path,
+			"Connect", NULL, &error,
+			connect_devices_callback, cde);
+
+	if (cde->cw->cpw) {
+		call_work_unlock(ns);
+		return TRUE;
+	}
+
+	call_work_destroy_unlocked(cde->cw);
+	call_work_unlock(ns);
+	cde->cw = NULL;
+out_error:
+	cde->error = g_strdup(BLUEZ_ERRMSG(error));
+	g_clear_error(&error);
+	return FALSE;
+}
+
+/* the caller holds a reference, so cdw can't go away in here */
+static void connect_devices_next(struct connect_devices_work *cdw)
+{
+	struct connect_devices_entry *cde;
+	guint idx;
+
+	while ((idx = g_atomic_int_add(&cdw->next, 1)) < cdw->n_entries) {
+		cde = &cdw->entries[idx];
+
+		if (connect_devices_start(cde))
+			return;
+
+		connect_devices_report(cde);
+		connect_devices_put(cdw);
+	}
+}
+
+static void connect_devices_callback(void *user_data,
+		GVariant *result, GError **error)
+{
+	struct connect_devices_entry *cde = user_data;
+	struct connect_devices_work *cdw = cde->cdw;
+	struct call_work *cw = cde->cw;
+
+	bluez_decode_call_error(cdw->ns,
+		cw->access_type, cw->type_arg, cw->bluez_method,
+		error);
+
+	if (error && *error) {
+		g_dbus_error_strip_remote_error(*error);
+		cde->error = g_strdup((*error)->message);
+	}
+
+	if (result)
+		g_variant_unref(result);
+
+	call_work_destroy(cw);
+	cde->cw = NULL;
+
+	connect_devices_report(cde);
+
+	/* keep the slot busy before giving up our reference */
+	connect_devices_next(cdw);
+	connect_devices_put(cdw);
+}
+
+/* FALSE if the entry is malformed, nothing is queued then */
+static gboolean connect_devices_entry_init(struct connect_devices_entry *cde,
+		const char *adapter, json_object *jdev)
+{
+	json_object *jval;
+	const char *device = NULL;
+
+	if (json_object_is_type(jdev, json_type_string)) {
+		device = json_object_get_string(jdev);
+	} else if (json_object_is_type(jdev, json_type_object)) {
+		if (json_object_object_get_ex(jdev, "device", &jval) &&
+		    json_object_is_type(jval, json_type_string))
+			device = json_object_get_string(jval);
+		if (json_object_object_get_ex(jdev, "uuid", &jval)) {
+			if (!json_object_is_type(jval, json_type_string))
+				return FALSE;
+			cde->uuid = g_strdup(json_object_get_string(jval));
+		}
+	}
+
+	cde->device = g_strdup(device ? device : "");
+	cde->path = device ? bluez_device_path(adapter, device) : NULL;
+
+	/* the adapter is part of the path too */
+	return cde->path && g_variant_is_object_path(cde->path);
+}
+
+static void bluetooth_connect_devices(afb_req_t request)
+{
+	struct bluetooth_state *ns = bluetooth_get_userdata(request);
+	json_object *jargs = afb_req_json(request);
+	json_object *jdevs = NULL, *jparsed = NULL;
+	struct connect_devices_work *cdw;
+	const char *adapter, *value;
+	glong concurrency;
+	gchar *end;
+	guint i;
+
+	if (!json_object_object_get_ex(jargs, "devices", &jdevs)) {
+		afb_req_fail(request, "failed", "No devices given");
+		return;
+	}
+
+	/* also accept the devices as a JSON string (query arguments) */
+	if (json_object_is_type(jdevs, json_type_string)) {
+		jparsed = json_tokener_parse(json_object_get_string(jdevs));
+		jdevs = jparsed;
+	}
+
+	if (!json_object_is_type(jdevs, json_type_array) ||
+	    !json_object_array_length(jdevs)) {
+		json_object_put(jparsed);
+		afb_req_fail(request, "failed", "Invalid devices given");
+		return;
+	}
+
+	concurrency = g_atomic_int_get(&ns->connect_concurrency);
+	value = afb_req_value(request, "concurrency");
+	if (value) {
+		errno = 0;
+		concurrency = strtol(value, &end, 10);
+		if (errno || end == value || *end ||
+		    concurrency <= 0 || concurrency > CONNECT_CONCURRENCY_MAX) {
+			json_object_put(jparsed);
+			afb_req_fail_f(request, "failed",
+					"Invalid concurrency, 1 to %d",
+					CONNECT_CONCURRENCY_MAX);
+			return;
+		}
+	}
+	if (concurrency <= 0)
+		concurrency = CONNECT_CONCURRENCY_DEFAULT;
+
+	cdw = g_malloc0(sizeof(*cdw));
+	cdw->ns = ns;
+	cdw->request = afb_req_addref(request);
+	cdw->n_entries = json_object_array_length(jdevs);
+	cdw->entries = g_new0(struct connect_devices_entry, cdw->n_entries);
+
+	adapter = afb_req_value(request, "adapter");
+	adapter = adapter ? adapter : bluetooth_get_default_adapter(ns);
+
+	for (i = 0; i < cdw->n_entries; i++) {
+		cdw->entries[i].cdw = cdw;
+		if (!connect_devices_entry_init(&cdw->entries[i], adapter,
+				json_object_array_get_idx(jdevs, i))) {
+			afb_req_fail_f(request, "failed",
+					"Invalid device parameter (entry %u)",
+					i);
+			json_object_put(jparsed);
+			connect_devices_free(cdw);
+			return;
+		}
+	}
+
+	json_object_put(jparsed);
+
+	/* one per entry, plus a guard while the first slots are filled */
+	g_atomic_int_set(&cdw->pending, cdw->n_entries + 1);
+
+	while (concurrency--)
+		connect_devices_next(cdw);
+
+	connect_devices_put(cdw);
+}
+
+static void disconnect_service_callback(void *user_data,
+		GVariant *result, GError **error)
+{
+	struct call_work *cw = user_data;
+	struct bluetooth_state *ns = cw->ns;
+
+	bluez_decode_call_error(ns,
+		cw->access_type, cw->type_arg, cw->bluez_method,
+		error);
+
+	if (error && *error) {
+		afb_req_fail_f(cw->request, "failed", "Disconnect error %s",
+				(*error)->message);
+		goto out_free;
+	}
+
+	if (result)
+		g_variant_unref(result);
+
+	afb_req_success_f(cw->request, json_object_new_object(),
+			"Device - Bluetooth %s disconnected", cw->type_arg);
+out_free:
+	afb_req_unref(cw->request);
+	call_work_destroy(cw);
+}
+
 static void bluetooth_disconnect_device(afb_req_t request)
 {
 	struct bluetooth_state *ns = bluetooth_get_userdata(request);
-	json_object *jresp;
-	GVariant *reply = NULL;
 	GError *error = NULL;
 	const char *uuid;
+	struct call_work *cw;
 	gchar *device;
 
 	device = return_bluez_path(request);
@@ -1036,26 +2431,45 @@ static void bluetooth_disconnect_device(afb_req_t request)
 	/* optional, disconnect single profile */
 	uuid = afb_req_value(request, "uuid");
 
+	call_work_lock(ns);
+
+	cw = call_work_create_unlocked(ns, "device", device,
+			"disconnect_service", uuid ? "DisconnectProfile" :
+			"Disconnect", &error);
+	if (!cw) {
+		call_work_unlock(ns);
+		afb_req_fail_f(request, "failed", "can't queue work %s",
+				error->message);
+		g_error_free(error);
+		goto out_free;
+	}
+
+	cw->request = request;
+	afb_req_addref(request);
+
+	/* issued with the lock held, the callback needs it to complete */
 	if (uuid)
-		reply = device_call(ns, device, "DisconnectProfile",
-				g_variant_new("(&s)", uuid), &error);
+		cw->cpw = bluez_call_async(ns, "device", device,
+			"DisconnectProfile", g_variant_new("(s)", uuid), &error,
+			disconnect_service_callback, cw);
 	else
-		reply = device_call(ns, device, "Disconnect", NULL, &error);
+		cw->cpw = bluez_call_async(ns, "device", device,
+			"Disconnect", NULL, &error,
+			disconnect_service_callback, cw);
 
-	if (!reply) {
+	if (!cw->cpw) {
+		call_work_destroy_unlocked(cw);
+		call_work_unlock(ns);
 		afb_req_fail_f(request, "failed", "Disconnect error %s",
-				error ? error->message : "unspecified");
-		g_free(device);
+				error->message);
+		afb_req_unref(request);
 		g_error_free(error);
-		return;
+		goto out_free;
 	}
 
-	g_variant_unref(reply);
-
-	jresp = json_object_new_object();
-	afb_req_success_f(request, jresp, "Device - Bluetooth %s disconnected",
-			device);
+	call_work_unlock(ns);
 
+out_free:
 	g_free(device);
 }
 
@@ -1098,9 +2512,12 @@ static void bluetooth_pair_device(afb_req_t request)
 		return;
 	}
 
-	cw = call_work_create(ns, "device", device,
+	call_work_lock(ns);
+
+	cw = call_work_create_unlocked(ns, "device", device,
 			"pair_device", "Pair", &error);
 	if (!cw) {
+		call_work_unlock(ns);
 		afb_req_fail_f(request, "failed", "can't queue work %s",
 				error->message);
 		g_error_free(error);
@@ -1110,61 +2527,108 @@ static void bluetooth_pair_device(afb_req_t request)
 	cw->request = request;
 	afb_req_addref(request);
 
+	/* issued with the lock held, the callback needs it to complete */
 	cw->cpw = bluez_call_async(ns, "device", device, "Pair", NULL, &error,
 			pair_service_callback, cw);
 
 	if (!cw->cpw) {
+		call_work_destroy_unlocked(cw);
+		call_work_unlock(ns);
 		afb_req_fail_f(request, "failed", "connection error %s",
 				error->message);
-		call_work_destroy(cw);
+		afb_req_unref(request);
 		g_error_free(error);
 		goto out_free;
 	}
 
+	call_work_unlock(ns);
+
 out_free:
 	g_free(device);
 
 }
 
+struct cancel_pairing_work {
+	afb_req_t request;
+	gchar *device;
+};
+
+static void cancel_pairing_callback(void *user_data,
+		GVariant *result, GError **error)
+{
+	struct cancel_pairing_work *cpw = user_data;
+
+	if (error && *error) {
+		g_dbus_error_strip_remote_error(*error);
+		afb_req_fail_f(cpw->request, "failed",
+				"device %s method %s error %s",
+				cpw->device, "CancelPairing",
+				(*error)->message);
+	} else {
+		afb_req_success(cpw->request, json_object_new_object(),
+				"Bluetooth - pairing canceled");
+	}
+
+	if (result)
+		g_variant_unref(result);
+
+	afb_req_unref(cpw->request);
+	g_free(cpw->device);
+	g_free(cpw);
+}
+
 static void bluetooth_cancel_pairing(afb_req_t request)
 {
 	struct bluetooth_state *ns = bluetooth_get_userdata(request);
+	struct cancel_pairing_work *cpw;
 	struct call_work *cw;
-	GVariant *reply = NULL;
 	GError *error = NULL;
-	gchar *device;
+	gchar *device = NULL;
+
+	/* optional, the device of the session; else the most recent one */
+	if (afb_req_value(request, "device")) {
+		device = return_bluez_path(request);
+		if (!device)
+			return;
+	}
 
 	call_work_lock(ns);
 
-	cw = call_work_lookup_unlocked(ns, "device", NULL, "RequestConfirmation");
+	cw = pairing_session_lookup_unlocked(ns, device);
 
-	if (!cw) {
+	/* a named device may still be before its confirmation request */
+	if (!cw && !device) {
 		call_work_unlock(ns);
 		afb_req_fail(request, "failed", "No pairing in progress");
 		return;
 	}
 
-	device = cw->agent_data.device_path;
-	reply = device_call(ns, device, "CancelPairing", NULL, &error);
+	cpw = g_malloc0(sizeof(*cpw));
+	cpw->request = afb_req_addref(request);
+	cpw->device = cw ? g_strdup(cw->agent_data.device_path) : device;
+	if (cw)
+		g_free(device);
 
-	if (!reply) {
-		call_work_unlock(ns);
+	call_work_unlock(ns);
+
+	/* don't hold the lock (or a worker) while BlueZ cancels */
+	if (!bluez_call_async(ns, BLUEZ_AT_DEVICE, cpw->device, "CancelPairing",
+			NULL, &error, cancel_pairing_callback, cpw)) {
 		afb_req_fail_f(request, "failed",
 				"device %s method %s error %s",
-				device, "CancelPairing", error->message);
-		return;
+				cpw->device, "CancelPairing", error->message);
+		g_error_free(error);
+		afb_req_unref(request);
+		g_free(cpw->device);
+		g_free(cpw);
 	}
-
-	call_work_unlock(ns);
-
-	afb_req_success(request, json_object_new_object(),
-			"Bluetooth - pairing canceled");
 }
 
 static void bluetooth_confirm_pairing(afb_req_t request)
 {
 	struct bluetooth_state *ns = bluetooth_get_userdata(request);
 	struct call_work *cw;
+	gchar *device = NULL;
 	int pin = -1;
 
 	const char *value = afb_req_value(request, "pincode");
@@ -1177,9 +2641,17 @@ static void bluetooth_confirm_pairing(afb_req_t request)
 		return;
 	}
 
+	/* optional, the device of the session; else the most recent one */
+	if (afb_req_value(request, "device")) {
+		device = return_bluez_path(request);
+		if (!device)
+			return;
+	}
+
 	call_work_lock(ns);
 
-	cw = call_work_lookup_unlocked(ns, "device", NULL, "RequestConfirmation");
+	cw = pairing_session_lookup_unlocked(ns, device);
+	g_free(device);
 
 	if (!cw) {
 		call_work_unlock(ns);
@@ -1200,18 +2672,45 @@ static void bluetooth_confirm_pairing(afb_req_t request)
 		afb_req_fail(request, "failed", "Bluetooth - pairing failed");
 	}
 
-	call_work_destroy_unlocked(cw);
+	pairing_session_end_unlocked(cw);
 	call_work_unlock(ns);
 }
 
+static void remove_device_callback(void *user_data,
+		GVariant *result, GError **error)
+{
+	struct call_work *cw = user_data;
+	struct bluetooth_state *ns = cw->ns;
+
+	bluez_decode_call_error(ns,
+		cw->access_type, cw->type_arg, cw->bluez_method,
+		error);
+
+	if (error && *error) {
+		afb_req_fail_f(cw->request, "failed",
+					" device %s method %s error %s",
+					cw->type_arg, "RemoveDevice",
+					(*error)->message);
+		goto out_free;
+	}
+
+	if (result)
+		g_variant_unref(result);
+
+	afb_req_success_f(cw->request, json_object_new_object(),
+			"Bluetooth - device %s removed", cw->type_arg);
+out_free:
+	afb_req_unref(cw->request);
+	call_work_destroy(cw);
+}
+
 static void bluetooth_remove_device(afb_req_t request)
 {
 	struct bluetooth_state *ns = bluetooth_get_userdata(request);
 	GError *error = NULL;
-	GVariant *reply;
-	json_object *jval = NULL;
-	const char *adapter;
-	gchar *device;
+	struct call_work *cw;
+	struct bluez_path bp;
+	gchar *device, *adapter = NULL;
 
 	device = return_bluez_path(request);
 	if (!device) {
@@ -1219,47 +2718,403 @@ static void bluetooth_remove_device(afb_req_t request)
 		return;
 	}
 
-	jval = bluez_get_property(ns, "device", device, FALSE, "Adapter", &error);	
-
-	if (!jval) {
+	/* the adapter is the parent object, no need to ask BlueZ */
+	bluez_path_parse(&bp, device);
+	if (bp.n == BLUEZ_PATH_DEVICE + 1)
+		adapter = bluez_path_dup_prefix(&bp, BLUEZ_PATH_ADAPTER);
+	if (!adapter) {
 		afb_req_fail_f(request, "failed",
-					" adapter not found for device %s error %s",
-					device, error->message);
+					" adapter not found for device %s",
+					device);
+		goto out_free;
+	}
 
+	call_work_lock(ns);
+
+	cw = call_work_create_unlocked(ns, "device", device,
+			"remove_device", "RemoveDevice", &error);
+	if (!cw) {
+		call_work_unlock(ns);
+		afb_req_fail_f(request, "failed", "can't queue work %s",
+				error->message);
 		g_error_free(error);
 		goto out_free;
 	}
 
-	adapter = json_object_get_string(jval);
+	cw->request = request;
+	afb_req_addref(request);
 
-	reply = adapter_call(ns, adapter, "RemoveDevice",
-			     g_variant_new("(o)", device), &error);
+	/* issued with the lock held, the callback needs it to complete */
+	cw->cpw = bluez_call_async(ns, "adapter", adapter, "RemoveDevice",
+			g_variant_new("(o)", device), &error,
+			remove_device_callback, cw);
 
-	if (!reply) {
+	if (!cw->cpw) {
+		call_work_destroy_unlocked(cw);
+		call_work_unlock(ns);
 		afb_req_fail_f(request, "failed",
 					" device %s method %s error %s",
 					device, "RemoveDevice", error->message);
+		afb_req_unref(request);
 		g_error_free(error);
 		goto out_free;
 	}
-	g_variant_unref(reply);
 
-	afb_req_success_f(request, json_object_new_object(),
-			"Bluetooth - device %s removed", adapter);
+	call_work_unlock(ns);
 
 out_free:
-	if (!jval)
-		json_object_put(jval);
+	g_free(adapter);
 	g_free(device);
+}
+
+/*
+ * set_properties validates all the requested properties up front and
+ * then sends all the Set calls at once; the results are joined into a
+ * single reply with the outcome of each property.
+ */
+struct set_properties_work;
+
+struct set_properties_entry {
+	struct set_properties_work *spw;
+	gchar *name;		/* as requested (json name) */
+	json_object *jval;
+	gchar *error;		/* one writer, read once all are done */
+};
+
+struct set_properties_work {
+	struct bluetooth_state *ns;
+	afb_req_t request;
+	const char *access_type;
+	gchar *path;
+	gint pending;
+	guint n_entries;
+	struct set_properties_entry *entries;
+};
+
+static void set_properties_free(struct set_properties_work *spw)
+{
+	guint i;
+
+	for (i = 0; i < spw->n_entries; i++) {
+		g_free(spw->entries[i].name);
+		g_free(spw->entries[i].error);
+		json_object_put(spw->entries[i].jval);
+	}
+	if (spw->request)
+		afb_req_unref(spw->request);
+	g_free(spw->entries);
+	g_free(spw->path);
+	g_free(spw);
+}
+
+static json_object *set_properties_results(struct set_properties_work *spw,
+		guint *failed)
+{
+	json_object *jresults = json_object_new_object();
+	struct set_properties_entry *spe;
+	json_object *jres;
+	guint i;
+
+	*failed = 0;
+	for (i = 0; i < spw->n_entries; i++) {
+		spe = &spw->entries[i];
+
+		jres = json_object_new_object();
+		json_object_object_add(jres, "success",
+				json_object_new_boolean(!spe->error));
+		if (spe->error) {
+			json_object_object_add(jres, "error",
+					json_object_new_string(spe->error));
+			(*failed)++;
+		}
+		json_object_object_add(jresults, spe->name, jres);
+	}
+
+	return jresults;
+}
+
+static void set_properties_put(struct set_properties_work *spw)
+{
+	json_object *jresp;
+	guint failed;
+
+	if (!g_atomic_int_dec_and_test(&spw->pending))
+		return;
+
+	jresp = json_object_new_object();
+	json_object_object_add(jresp, "results",
+			set_properties_results(spw, &failed));
+
+	if (!failed)
+		afb_req_success_f(spw->request, jresp,
+				"Bluetooth - %s properties set",
+				spw->access_type);
+	else
+		afb_req_reply_f(spw->request, jresp, "failed",
+				"%s %s - %u of %u properties failed",
+				spw->access_type, spw->path,
+				failed, spw->n_entries);
+
+	set_properties_free(spw);
+}
+
+static void set_properties_callback(void *user_data,
+		GVariant *result, GError **error)
+{
+	struct set_properties_entry *spe = user_data;
+
+	if (error && *error) {
+		g_dbus_error_strip_remote_error(*error);
+		spe->error = g_strdup((*error)->message);
+	}
+
+	if (result)
+		g_variant_unref(result);
+
+	set_properties_put(spe->spw);
+}
+
+/* NOTE: jprops is only borrowed */
+static gboolean set_properties_validate(struct set_properties_work *spw,
+		json_object *jprops)
+{
+	const struct property_info *pi, *pi_prop;
+	struct set_properties_entry *spe;
+	gboolean is_config, valid = TRUE;
+	GError *error = NULL;
+	GVariant *arg;
+	guint i = 0;
+
+	pi = bluez_get_property_info(spw->access_type, NULL);
+
+	spw->n_entries = json_object_object_length(jprops);
+	spw->entries = g_new0(struct set_properties_entry, spw->n_entries);
+
+	json_object_object_foreach(jprops, key, jval) {
+		spe = &spw->entries[i++];
+		spe->spw = spw;
+		spe->name = g_strdup(key);
+		spe->jval = json_object_get(jval);
+
+		pi_prop = property_by_json_name(pi, key, &is_config);
+		if (!pi_prop) {
+			spe->error = g_strdup_printf(
+					"unknown property with name %s", key);
+			valid = FALSE;
+			continue;
+		}
+
+		arg = property_json_to_gvariant(pi_prop, NULL, NULL, jval,
+				&error);
+		if (!arg) {
+			spe->error = g_strdup_printf("invalid value for %s: %s",
+					key, BLUEZ_ERRMSG(error));
+			g_clear_error(&error);
+			valid = FALSE;
+			continue;
+		}
+		g_variant_unref(g_variant_ref_sink(arg));
+	}
+
+	return valid;
+}
+
+static void bluetooth_set_properties(afb_req_t request)
+{
+	struct bluetooth_state *ns = bluetooth_get_userdata(request);
+	json_object *jargs = afb_req_json(request);
+	json_object *jprops = NULL, *jparsed = NULL, *jresp;
+	struct set_properties_work *spw;
+	struct set_properties_entry *spe;
+	const char *adapter;
+	GError *error = NULL;
+	guint i, failed;
+
+	if (!json_object_object_get_ex(jargs, "properties", &jprops)) {
+		afb_req_fail(request, "failed", "No properties given");
+		return;
+	}
+
+	/* also accept the properties as a JSON string (query arguments) */
+	if (json_object_is_type(jprops, json_type_string)) {
+		jparsed = json_tokener_parse(json_object_get_string(jprops));
+		jprops = jparsed;
+	}
+
+	if (!json_object_is_type(jprops, json_type_object) ||
+	    !json_object_object_length(jprops)) {
+		json_object_put(jparsed);
+		afb_req_fail(request, "failed", "Invalid properties given");
+		return;
+	}
+
+	spw = g_malloc0(sizeof(*spw));
+	spw->ns = ns;
+
+	if (afb_req_value(request, "device")) {
+		spw->path = return_bluez_path(request);
+		if (!spw->path) {
+			/* return_bluez_path() already failed the request */
+			json_object_put(jparsed);
+			set_properties_free(spw);
+			return;
+		}
+		spw->access_type = BLUEZ_AT_DEVICE;
+	} else {
+		adapter = afb_req_value(request, "adapter");
+		adapter = BLUEZ_ROOT_PATH(adapter ? adapter :
+				bluetooth_get_default_adapter(ns));
+		spw->path = g_strdup(adapter);
+		spw->access_type = BLUEZ_AT_ADAPTER;
+	}
+
+	if (!g_variant_is_object_path(spw->path)) {
+		afb_req_fail_f(request, "failed", "Invalid %s parameter",
+				spw->access_type);
+		json_object_put(jparsed);
+		set_properties_free(spw);
+		return;
+	}
+
+	/* nothing is sent unless every property is valid */
+	if (!set_properties_validate(spw, jprops)) {
+		jresp = json_object_new_object();
+		json_object_object_add(jresp, "results",
+				set_properties_results(spw, &failed));
+		afb_req_reply_f(request, jresp, "failed",
+				"%s %s - %u of %u properties invalid",
+				spw->access_type, spw->path,
+				failed, spw->n_entries);
+		json_object_put(jparsed);
+		set_properties_free(spw);
+		return;
+	}
+	json_object_put(jparsed);
+
+	spw->request = afb_req_addref(request);
+
+	/* guard, so the reply can't go out while still issuing calls */
+	g_atomic_int_set(&spw->pending, 1);
+
+	for (i = 0; i < spw->n_entries; i++) {
+		spe = &spw->entries[i];
+
+		g_atomic_int_inc(&spw->pending);
+		if (!bluez_set_property_async(ns, spw->access_type, spw->path,
+				TRUE, spe->name, json_object_get(spe->jval),
+				&error, set_properties_callback, spe)) {
+			spe->error = g_strdup(BLUEZ_ERRMSG(error));
+			g_clear_error(&error);
+			set_properties_put(spw);
+		}
+	}
+
+	set_properties_put(spw);
+}
+
+/*
+ * AVRCP requests are not exclusive, so they only keep the request
+ * around while the (async) BlueZ calls complete.
+ */
+struct avrcp_work {
+	struct bluetooth_state *ns;
+	afb_req_t request;
+	gchar *player;
+	gchar *device;		/* connect/disconnect only */
+	const char *method;	/* ConnectProfile or DisconnectProfile */
+	int uuid;		/* next entry of avrcp_uuids */
+};
+
+static const char * const avrcp_uuids[] = {
+	"0000110a-0000-1000-8000-00805f9b34fb",
+	"0000110e-0000-1000-8000-00805f9b34fb",
+	NULL
+};
+
+static void avrcp_work_done(struct avrcp_work *aw)
+{
+	afb_req_success(aw->request, NULL, "Bluetooth - AVRCP controls");
+
+	afb_req_unref(aw->request);
+	g_free(aw->device);
+	g_free(aw->player);
+	g_free(aw);
+}
+
+static void avrcp_profile_next(struct avrcp_work *aw);
+
+static void avrcp_profile_callback(void *user_data,
+		GVariant *result, GError **error)
+{
+	struct avrcp_work *aw = user_data;
+
+	/* a failing profile stops the sequence, the request still succeeds */
+	if (!result) {
+		AFB_DEBUG("device %s method %s error %s", aw->device,
+				aw->method, BLUEZ_ERRMSG(*error));
+		avrcp_work_done(aw);
+		return;
+	}
+
+	g_variant_unref(result);
+
+	aw->uuid++;
+	avrcp_profile_next(aw);
+}
+
+static void avrcp_profile_next(struct avrcp_work *aw)
+{
+	struct bluez_pending_work *cpw;
+	GError *error = NULL;
+
+	if (!avrcp_uuids[aw->uuid]) {
+		avrcp_work_done(aw);
+		return;
+	}
+
+	cpw = bluez_call_async(aw->ns, BLUEZ_AT_DEVICE, aw->device,
+			aw->method, g_variant_new("(s)", avrcp_uuids[aw->uuid]),
+			&error, avrcp_profile_callback, aw);
+	if (!cpw) {
+		g_clear_error(&error);
+		avrcp_work_done(aw);
+	}
+}
+
+static void avrcp_action_callback(void *user_data,
+		GVariant *result, GError **error)
+{
+	struct avrcp_work *aw = user_data;
+
+	bluez_decode_call_error(aw->ns, BLUEZ_AT_MEDIAPLAYER, aw->player,
+			aw->method, error);
+
+	if (error && *error) {
+		g_dbus_error_strip_remote_error(*error);
+		afb_req_fail_f(aw->request, "failed",
+				"mediaplayer %s method %s error %s",
+				aw->player, aw->method, BLUEZ_ERRMSG(*error));
+
+		afb_req_unref(aw->request);
+		g_free(aw->player);
+		g_free(aw);
+		return;
+	}
+
+	if (result)
+		g_variant_unref(result);
 
+	avrcp_work_done(aw);
 }
 
 static void bluetooth_avrcp_controls(afb_req_t request)
 {
 	struct bluetooth_state *ns = bluetooth_get_userdata(request);
 	const char *action = afb_req_value(request, "action");
+	struct bluez_pending_work *cpw;
+	struct avrcp_work *aw;
+	struct bluez_path bp;
 	gchar *device, *player;
-	GVariant *reply;
 	GError *error = NULL;
 
 	if (!action) {
@@ -1273,7 +3128,7 @@ static void bluetooth_avrcp_controls(afb_req_t request)
 		player = g_strconcat(device, "/", BLUEZ_DEFAULT_PLAYER, NULL);
 		g_free(device);
 	} else {
-		player = g_strdup(ns->mediaplayer_path);
+		player = mediaplayer1_dup_path(ns);
 	}
 
 	if (!player) {
@@ -1281,25 +3136,118 @@ static void bluetooth_avrcp_controls(afb_req_t request)
 		return;
 	}
 
+	aw = g_malloc0(sizeof(*aw));
+	aw->ns = ns;
+	aw->request = request;
+	aw->player = player;
+	afb_req_addref(request);
+
 	if (!g_strcmp0(action, "connect") || !g_strcmp0(action, "disconnect")) {
-		mediaplayer1_connect_disconnect(ns, player, !!g_strcmp0(action, "disconnect"));
-		goto out_success;
+		/* the player is a child of the device */
+		bluez_path_parse(&bp, player);
+		if (bp.n > 1)
+			aw->device = bluez_path_dup_prefix(&bp, bp.n - 2);
+		aw->method = g_strcmp0(action, "disconnect") ?
+			"ConnectProfile" : "DisconnectProfile";
+		avrcp_profile_next(aw);
+		return;
 	}
 
-	reply = mediaplayer_call(ns, player, action, NULL, &error);
-
-	if (!reply) {
+	aw->method = action;
+	cpw = bluez_call_async(ns, BLUEZ_AT_MEDIAPLAYER, player, action,
+			NULL, &error, avrcp_action_callback, aw);
+	if (!cpw) {
 		afb_req_fail_f(request, "failed",
 				"mediaplayer %s method %s error %s",
 				player, action, BLUEZ_ERRMSG(error));
-		g_free(player);
 		g_error_free(error);
+
+		afb_req_unref(request);
+		g_free(player);
+		g_free(aw);
+	}
+}
+
+static json_object *call_work_json(struct call_work *cw, gint64 now)
+{
+	json_object *jop = json_object_new_object();
+
+	json_object_object_add(jop, "id", json_object_new_int(cw->id));
+	json_object_object_add(jop, "operation",
+			json_object_new_string(cw->method));
+	if (cw->type_arg && g_str_has_prefix(cw->type_arg, BLUEZ_PATH "/"))
+		json_process_path(jop, cw->type_arg);
+	json_object_object_add(jop, "age", json_object_new_int64(
+			(now - cw->start_time) / G_TIME_SPAN_MILLISECOND));
+
+	return jop;
+}
+
+static void bluetooth_cancel(afb_req_t request)
+{
+	struct bluetooth_state *ns = bluetooth_get_userdata(request);
+	const char *id = afb_req_value(request, "id");
+	json_object *jresp, *jarray;
+	gint64 now = g_get_monotonic_time();
+	GSList *aborts = NULL;
+	GHashTableIter iter;
+	struct call_work *cw;
+	gchar *device = NULL, *end;
+	glong cw_id = 0;
+
+	if (id) {
+		errno = 0;
+		cw_id = strtol(id, &end, 10);
+		if (errno || end == id || *end ||
+		    cw_id <= 0 || cw_id > G_MAXINT) {
+			afb_req_fail_f(request, "failed",
+					"Invalid id parameter %s", id);
+			return;
+		}
+	} else if (afb_req_value(request, "device")) {
+		device = return_bluez_path(request);
+		if (!device)
+			return;
+	}
+
+	jarray = json_object_new_array();
+
+	call_work_lock(ns);
+	g_hash_table_iter_init(&iter, ns->cw_by_id);
+	while (g_hash_table_iter_next(&iter, NULL, (gpointer *)&cw)) {
+		/* without id or device only list what is pending */
+		if (!id && !device) {
+			json_object_array_add(jarray, call_work_json(cw, now));
+			continue;
+		}
+
+		if (id ? cw->id != cw_id : g_strcmp0(cw->type_arg, device))
+			continue;
+
+		if (call_work_cancel_unlocked(cw, "operation canceled",
+				&aborts))
+			json_object_array_add(jarray, call_work_json(cw, now));
+	}
+	call_work_unlock(ns);
+
+	call_work_abort(ns, aborts);
+
+	jresp = json_object_new_object();
+
+	if (!id && !device) {
+		json_object_object_add(jresp, "pending", jarray);
+		afb_req_success(request, jresp, "Bluetooth - pending operations");
 		return;
 	}
 
-out_success:
-	g_free(player);
-	afb_req_success(request, NULL, "Bluetooth - AVRCP controls");
+	g_free(device);
+	json_object_object_add(jresp, "canceled", jarray);
+
+	if (!json_object_array_length(jarray))
+		afb_req_reply(request, jresp, "failed",
+				"No cancelable operation pending");
+	else
+		afb_req_success(request, jresp, "Bluetooth - canceled");
 }
 
 static void bluetooth_version(afb_req_t request)
@@ -1342,6 +3290,11 @@ static const struct afb_verb_v3 bluetooth_verbs[] = {
 		.session = AFB_SESSION_NONE,
 		.callback = bluetooth_connect_device,
 		.info = "Connect device and/or profile"
+	}, {
+		.verb = "connect_devices",
+		.session = AFB_SESSION_NONE,
+		.callback = bluetooth_connect_devices,
+		.info = "Connect several devices, a few at a time",
 	}, {
 		.verb = "disconnect",
 		.session = AFB_SESSION_NONE,
@@ -1367,11 +3320,21 @@ static const struct afb_verb_v3 bluetooth_verbs[] = {
 		.session = AFB_SESSION_NONE,
 		.callback = bluetooth_remove_device,
 		.info = "Removed paired device",
+	}, {
+		.verb = "set_properties",
+		.session = AFB_SESSION_NONE,
+		.callback = bluetooth_set_properties,
+		.info = "Set several adapter or device properties at once",
 	}, {
 		.verb = "avrcp_controls",
 		.session = AFB_SESSION_NONE,
 		.callback = bluetooth_avrcp_controls,
 		.info = "AVRCP controls"
+	}, {
+		.verb = "cancel",
+		.session = AFB_SESSION_NONE,
+		.callback = bluetooth_cancel,
+		.info = "Cancel pending operations by id or device, or list them",
 	}, {
 		.verb = "version",
 		.session = AFB_SESSION_NONE,
@@ -41,7 +41,6 @@
 
 #define BLUEZ_ROOT_PATH(_t) \
     ({ \
-     call_work_lock(ns); \
      const char *__t = (_t); \
      size_t __len = strlen(BLUEZ_PATH) + 1 + \
      strlen(__t) + 1; \
@@ -49,12 +48,11 @@
      __tpath = alloca(__len + 1 + 1); \
      snprintf(__tpath, __len + 1, \
              BLUEZ_PATH "/%s", __t); \
-     call_work_unlock(ns); \
              __tpath; \
      })
 
 #define BLUEZ_ERRMSG(error) \
-     (error ? error->message : "unspecified")
+     ((error) ? (error)->message : "unspecified")
 
 #define FREEDESKTOP_INTROSPECT			"org.freedesktop.DBus.Introspectable"
 #define FREEDESKTOP_PROPERTIES			"org.freedesktop.DBus.Properties"
@@ -77,69 +75,117 @@
 struct bluetooth_state;
 
 
-static inline int split_length(const char *path) {
-	gchar **strings = g_strsplit(path, "/", -1);
-	int ret = g_strv_length(strings) ;
+/*
+ * BlueZ object path split into its '/' separated components in a
+ * single pass and without copying; each component is kept as a span
+ * into the original string, which must outlive the structure.
+ *
+ * Component numbering follows g_strsplit(), i.e. for
+ * /org/bluez/hci0/dev_88_0F_10_96_D3_20/fd0 component 0 is empty,
+ * 3 is the adapter, 4 the device and 5 the endpoint or player.
+ */
+#define BLUEZ_PATH_MAX_COMPONENTS		8
+
+#define BLUEZ_PATH_ADAPTER			3
+#define BLUEZ_PATH_DEVICE			4
+#define BLUEZ_PATH_LEAF				5
+
+struct bluez_path {
+	const char *path;
+	int n;		/* number of components */
+	struct {
+		unsigned int off;
+		unsigned int len;
+	} c[BLUEZ_PATH_MAX_COMPONENTS];
+};
+
+static inline void bluez_path_parse(struct bluez_path *bp, const char *path)
+{
+	const char *s, *start;
 
-	g_strfreev(strings);
-	return ret;
+	bp->path = path;
+	bp->n = 0;
+
+	if (!path || !*path)
+		return;
+
+	for (s = start = path; ; s++) {
+		if (*s != '/' && *s)
+			continue;
+
+		if (bp->n < BLUEZ_PATH_MAX_COMPONENTS) {
+			bp->c[bp->n].off = start - path;
+			bp->c[bp->n].len = s - start;
+		}
+		bp->n++;
+
+		if (!*s)
+			break;
+		start = s + 1;
+	}
 }
 
-static inline gchar *find_index(const char *path, int idx)
+static inline gboolean bluez_path_has(const struct bluez_path *bp, int idx)
 {
-	gchar **strings = g_strsplit(path, "/", -1);
-	gchar *item = NULL;
+	return idx < bp->n && idx < BLUEZ_PATH_MAX_COMPONENTS;
+}
 
-	if (g_strv_length(strings) > idx)
-		item = g_strdup(strings[idx]);
+/* NOTE: not NUL terminated unless it is the last component */
+static inline const char *bluez_path_component(const struct bluez_path *bp,
+		int idx, size_t *len)
+{
+	if (!bluez_path_has(bp, idx))
+		return NULL;
 
-	g_strfreev(strings);
-	return item;
+	*len = bp->c[idx].len;
+	return bp->path + bp->c[idx].off;
 }
 
-static inline gchar *bluez_return_adapter(const char *path)
+static inline json_object *bluez_path_component_json(
+		const struct bluez_path *bp, int idx)
 {
-	return find_index(path, 3);
+	const char *s;
+	size_t len;
+
+	s = bluez_path_component(bp, idx, &len);
+	if (!s)
+		return NULL;
+
+	return json_object_new_string_len(s, len);
 }
 
-static inline gchar *bluez_return_device(const char *path)
+/* the path up to and including component idx, e.g. the adapter of a device */
+static inline gchar *bluez_path_dup_prefix(const struct bluez_path *bp,
+		int idx)
 {
-	return find_index(path, 4);
+	if (!bluez_path_has(bp, idx))
+		return NULL;
+
+	return g_strndup(bp->path, bp->c[idx].off + bp->c[idx].len);
 }
 
-static inline gboolean is_mediaplayer1_interface(const char *path)
+static inline gboolean bluez_path_is_mediaplayer(const struct bluez_path *bp)
 {
-	gchar *data = NULL;
-	gboolean ret;
-
 	// Don't trigger on NowPlaying, Item, etc paths
-	if (split_length(path) != 6)
+	if (bp->n != BLUEZ_PATH_LEAF + 1)
 		return FALSE;
 
 	// Check for 'playerX' suffix, not always player0
-	data = find_index(path, 5);
-	ret = !strncmp(data, BLUEZ_DEFAULT_PLAYER, sizeof(BLUEZ_DEFAULT_PLAYER) - 1);
-	g_free(data);
-
-	return ret;
+	return !strncmp(bp->path + bp->c[BLUEZ_PATH_LEAF].off,
+			BLUEZ_DEFAULT_PLAYER, sizeof(BLUEZ_DEFAULT_PLAYER) - 1);
 }
 
-static inline gboolean is_mediatransport1_interface(const char *path)
+static inline gboolean bluez_path_is_mediatransport(const struct bluez_path *bp)
 {
-	gchar *data = NULL;
-	gboolean ret;
-
 	// Don't trigger on NowPlaying, Item, etc paths
-	if (split_length(path) != 6)
+	if (bp->n != BLUEZ_PATH_LEAF + 1)
 		return FALSE;
 
-	data = find_index(path, 5);
-	ret = g_str_has_prefix(data, "fd");
-	g_free(data);
-
-	return ret;
+	return g_str_has_prefix(bp->path + bp->c[BLUEZ_PATH_LEAF].off, "fd");
 }
 
+void json_process_bluez_path(json_object *jresp, const struct bluez_path *bp);
+
 struct bluetooth_state *bluetooth_get_userdata(afb_req_t request);
 
 struct call_work *call_work_create_unlocked(struct bluetooth_state *ns,
@@ -149,6 +195,8 @@ struct call_work *call_work_create_unlocked(struct bluetooth_state *ns,
 
 void call_work_destroy_unlocked(struct call_work *cw);
 
+void call_work_destroy(struct call_work *cw);
+
 void call_work_lock(struct bluetooth_state *ns);
 
 void call_work_unlock(struct bluetooth_state *ns);
@@ -158,9 +206,21 @@ struct call_work *call_work_lookup_unlocked(
 		const char *access_type, const char *type_arg,
 		const char *method);
 
+struct call_work *call_work_lookup_by_id_unlocked(
+		struct bluetooth_state *ns, int id);
+
+void bluez_property_index_init(void);
+
 const struct property_info *bluez_get_property_info(
 		const char *access_type, GError **error);
 
+const char *bluez_interface_to_access_type(const char *interface);
+
+const char *bluez_access_type_to_interface(const char *access_type);
+
+json_object *bluez_object_json(const char *access_type, const char *path,
+		json_object *jprop);
+
 gboolean bluez_property_dbus2json(const char *access_type,
 		json_object *jprop, const gchar *key, GVariant *var,
 		gboolean *is_config,
@@ -183,8 +243,6 @@ gboolean bluez_set_property(struct bluetooth_state *ns,
 		gboolean is_json_name, const char *name, json_object *jval,
 		GError **error);
 
-gboolean bluetooth_autoconnect(gpointer data);
-
 /* convenience access methods */
 static inline gboolean device_property_dbus2json(json_object *jprop,
 		const gchar *key, GVariant *var, gboolean *is_config,
@@ -300,15 +358,21 @@ static inline json_object *object_properties(struct bluetooth_state *ns,
 			BLUEZ_AT_OBJECT, BLUEZ_OBJECT_PATH, error);
 }
 
+/* recycled with its cancellable once the call completes */
 struct bluez_pending_work {
 	struct bluetooth_state *ns;
 	void *user_data;
 	GCancellable *cancel;
 	void (*callback)(void *user_data, GVariant *result, GError **error);
+	const char *cancel_reason;	/* static string */
+	struct bluez_pending_work *next_free;
 };
 
+void bluez_call_pool_init(struct bluetooth_state *ns);
+void bluez_call_pool_cleanup(struct bluetooth_state *ns);
+
 void bluez_cancel_call(struct bluetooth_state *ns,
-		struct bluez_pending_work *cpw);
+		struct bluez_pending_work *cpw, const char *reason);
 
 struct bluez_pending_work *
 bluez_call_async(struct bluetooth_state *ns,
@@ -317,6 +381,31 @@ bluez_call_async(struct bluetooth_state *ns,
 		void (*callback)(void *user_data, GVariant *result, GError **error),
 		void *user_data);
 
+json_object *bluez_properties_json(const char *access_type,
+		GVariant *reply, GError **error);
+
+json_object *bluez_objects_json(GVariant *reply);
+
+struct bluez_pending_work *
+bluez_get_objects_async(struct bluetooth_state *ns, GError **error,
+		void (*callback)(void *user_data, GVariant *result, GError **error),
+		void *user_data);
+
+struct bluez_pending_work *
+bluez_get_properties_async(struct bluetooth_state *ns,
+		const char *access_type, const char *path, GError **error,
+		void (*callback)(void *user_data, GVariant *result, GError **error),
+		void *user_data);
+
+/* NOTE: jval is consumed */
+struct bluez_pending_work *
+bluez_set_property_async(struct bluetooth_state *ns,
+		const char *access_type, const char *path,
+		gboolean is_json_name, const char *name, json_object *jval,
+		GError **error,
+		void (*callback)(void *user_data, GVariant *result, GError **error),
+		void *user_data);
+
 void bluez_decode_call_error(struct bluetooth_state *ns,
 		const char *access_type, const char *type_arg,
 		const char *method,
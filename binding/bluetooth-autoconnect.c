@@ -0,0 +1,532 @@
+/*
+ * Copyright 2019 Konsulko Group
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <errno.h>
+
+#include <glib.h>
+#include <stdlib.h>
+#include <gio/gio.h>
+#include <glib-object.h>
+
+#include <json-c/json.h>
+
+#define AFB_BINDING_VERSION 3
+#include <afb/afb-binding.h>
+
+#include "bluetooth-api.h"
+#include "bluetooth-common.h"
+
+/*
+ * Autoconnect of the paired devices at startup.
+ *
+ * Devices are tried in the order of the persisted autoconnect_priority
+ * list, then most recently connected first (autoconnect_history, which
+ * the binding keeps up to date), then the rest in path order.
+ *
+ * Up to connect_concurrency Connect calls run at once, but never more
+ * than it takes to reach autoconnect_max connected devices; a device
+ * that fails is retried after an exponential backoff until it is out of
+ * attempts. The scheduler goes away once nothing is left to do.
+ *
+ * With autoconnect_sightings a failed device isn't retried on a timer
+ * but parked until it is seen again, i.e. it reports an RSSI or BlueZ
+ * (re)announces it; out of range devices then cost no page attempts.
+ *
+ * Apart from bluetooth_autoconnect_start() everything runs in the main
+ * loop thread, so none of this needs locking.
+ */
+#define AUTOCONNECT_HISTORY_MAX		8
+#define AUTOCONNECT_BACKOFF_MAX		(60 * 1000)
+
+struct autoconnect;
+
+struct autoconnect_device {
+	struct autoconnect *ac;
+	gchar *path;
+	guint rank;
+	guint attempts;
+	gint64 next_try;	/* monotonic time in us */
+	gboolean sighted;	/* seen since the last failure */
+	struct call_work *cw;	/* while connecting */
+	gboolean done;
+};
+
+struct autoconnect {
+	struct bluetooth_state *ns;
+	afb_api_t api;
+
+	guint max_connected;
+	guint concurrency;
+	guint retries;
+	guint backoff;		/* ms */
+	gboolean sightings;
+
+	gchar **priority;	/* device names, highest first */
+	gchar **history;	/* device names, most recent first */
+
+	GPtrArray *devices;	/* NULL unless running */
+	guint kick;
+	guint loads;
+	guint connected;
+	guint in_flight;
+	guint timeout;
+	gint64 timeout_at;
+};
+
+static guint strv_index(gchar **strv, const char *str)
+{
+	guint i;
+
+	for (i = 0; strv && strv[i]; i++) {
+		if (!strcmp(strv[i], str))
+			return i;
+	}
+
+	return G_MAXUINT;
+}
+
+/* the device component of a device path, e.g. dev_00_11_22_33_44_55 */
+static gchar *autoconnect_device_name(const char *path)
+{
+	struct bluez_path bp;
+	const char *s;
+	size_t len;
+
+	bluez_path_parse(&bp, path);
+	s = bluez_path_component(&bp, BLUEZ_PATH_DEVICE, &len);
+
+	return s ? g_strndup(s, len) : NULL;
+}
+
+static void autoconnect_device_free(gpointer data)
+{
+	struct autoconnect_device *dev = data;
+
+	g_free(dev->path);
+	g_free(dev);
+}
+
+static gint autoconnect_device_compare(gconstpointer a, gconstpointer b)
+{
+	const struct autoconnect_device *dev_a =
+		*(const struct autoconnect_device **)a;
+	const struct autoconnect_device *dev_b =
+		*(const struct autoconnect_device **)b;
+
+	return (dev_a->rank > dev_b->rank) - (dev_a->rank < dev_b->rank);
+}
+
+static gboolean autoconnect_load(struct autoconnect *ac)
+{
+	struct autoconnect_device *dev;
+	guint i, idx, n_priority, n_history;
+	gchar **paths, *name;
+
+	paths = bluez_cache_get_paired_devices(ac->ns, &ac->connected);
+	if (!paths)
+		return FALSE;
+
+	n_priority = ac->priority ? g_strv_length(ac->priority) : 0;
+	n_history = ac->history ? g_strv_length(ac->history) : 0;
+
+	ac->devices = g_ptr_array_new_with_free_func(autoconnect_device_free);
+
+	for (i = 0; paths[i]; i++) {
+		name = autoconnect_device_name(paths[i]);
+		if (!name)
+			continue;
+
+		dev = g_malloc0(sizeof(*dev));
+		dev->ac = ac;
+		dev->path = g_strdup(paths[i]);
+		/* range is unknown at startup, so try everything once */
+		dev->sighted = TRUE;
+
+		idx = strv_index(ac->priority, name);
+		if (idx != G_MAXUINT) {
+			dev->rank = idx;
+		} else {
+			idx = strv_index(ac->history, name);
+			dev->rank = n_priority + (idx != G_MAXUINT ? idx :
+					n_history + i);
+		}
+		g_free(name);
+
+		g_ptr_array_add(ac->devices, dev);
+	}
+	g_strfreev(paths);
+
+	g_ptr_array_sort(ac->devices, autoconnect_device_compare);
+
+	return TRUE;
+}
+
+static void autoconnect_stop(struct autoconnect *ac)
+{
+	AFB_INFO("autoconnect done, %u device(s) connected", ac->connected);
+
+	if (ac->timeout)
+		g_source_remove(ac->timeout);
+	ac->timeout = 0;
+
+	g_ptr_array_unref(ac->devices);
+	ac->devices = NULL;
+}
+
+static void autoconnect_failed(struct autoconnect *ac,
+		struct autoconnect_device *dev)
+{
+	guint64 delay;
+
+	if (++dev->attempts > ac->retries) {
+		AFB_INFO("autoconnect of %s given up", dev->path);
+		dev->done = TRUE;
+		return;
+	}
+
+	delay = (guint64)ac->backoff << MIN(dev->attempts - 1, 16);
+	delay = MIN(delay, AUTOCONNECT_BACKOFF_MAX);
+
+	dev->next_try = g_get_monotonic_time() +
+		(gint64)delay * G_TIME_SPAN_MILLISECOND;
+	dev->sighted = !ac->sightings;
+}
+
+static struct autoconnect_device *autoconnect_device_lookup(
+		struct autoconnect *ac, const char *path)
+{
+	struct autoconnect_device *dev;
+	guint i;
+
+	if (!ac->devices)
+		return NULL;
+
+	for (i = 0; i < ac->devices->len; i++) {
+		dev = g_ptr_array_index(ac->devices, i);
+		if (!strcmp(dev->path, path))
+			return dev;
+	}
+
+	return NULL;
+}
+
+static void autoconnect_device_connected(struct autoconnect *ac,
+		struct autoconnect_device *dev)
+{
+	if (dev->done)
+		return;
+
+	dev->done = TRUE;
+	ac->connected++;
+}
+
+static void autoconnect_run(struct autoconnect *ac);
+
+static gboolean autoconnect_timeout(gpointer data)
+{
+	struct autoconnect *ac = data;
+
+	ac->timeout = 0;
+	autoconnect_run(ac);
+
+	return G_SOURCE_REMOVE;
+}
+
+static void autoconnect_callback(void *user_data,
+		GVariant *result, GError **error)
+{
+	struct autoconnect_device *dev = user_data;
+	struct autoconnect *ac = dev->ac;
+	struct call_work *cw = dev->cw;
+
+	bluez_decode_call_error(ac->ns,
+		cw->access_type, cw->type_arg, cw->bluez_method,
+		error);
+
+	call_work_destroy(cw);
+	dev->cw = NULL;
+	ac->in_flight--;
+
+	if (error && *error) {
+		g_dbus_error_strip_remote_error(*error);
+		AFB_INFO("autoconnect of %s failed: %s", dev->path,
+				(*error)->message);
+		autoconnect_failed(ac, dev);
+	} else {
+		autoconnect_device_connected(ac, dev);
+	}
+
+	if (result)
+		g_variant_unref(result);
+
+	autoconnect_run(ac);
+}
+
+static void autoconnect_connect(struct autoconnect *ac,
+		struct autoconnect_device *dev)
+{
+	struct bluetooth_state *ns = ac->ns;
+	GError *error = NULL;
+
+	/*
+	 * shares the per device slot with the connect verbs; issued with
+	 * the lock held, the callback needs it to complete
+	 */
+	call_work_lock(ns);
+	dev->cw = call_work_create_unlocked(ns, "device", dev->path,
+			"connect_service", "Connect", &error);
+	if (dev->cw) {
+		dev->cw->cpw = bluez_call_async(ns, "device", dev->path,
+				"Connect", NULL, &error,
+				autoconnect_callback, dev);
+		if (!dev->cw->cpw) {
+			call_work_destroy_unlocked(dev->cw);
+			dev->cw = NULL;
+		}
+	}
+	call_work_unlock(ns);
+
+	if (!dev->cw) {
+		AFB_INFO("autoconnect of %s not started: %s", dev->path,
+				BLUEZ_ERRMSG(error));
+		g_clear_error(&error);
+		autoconnect_failed(ac, dev);
+		return;
+	}
+
+	ac->in_flight++;
+}
+
+static void autoconnect_run(struct autoconnect *ac)
+{
+	struct autoconnect_device *dev;
+	gint64 now, wake = G_MAXINT64;
+	gboolean remaining = FALSE;
+	guint i;
+
+	if (!ac->devices)
+		return;
+
+	if (ac->connected >= ac->max_connected)
+		goto out_check;
+
+	now = g_get_monotonic_time();
+
+	for (i = 0; i < ac->devices->len; i++) {
+		dev = g_ptr_array_index(ac->devices, i);
+
+		if (dev->done || dev->cw)
+			continue;
+
+		/* each call in flight may end up taking a connected slot */
+		if (ac->in_flight >= ac->concurrency ||
+		    ac->connected + ac->in_flight >= ac->max_connected) {
+			remaining = TRUE;
+			break;
+		}
+
+		if (dev->sighted && dev->next_try <= now)
+			autoconnect_connect(ac, dev);
+
+		if (!dev->cw && !dev->done) {
+			remaining = TRUE;
+			/* parked devices wait for a sighting, not a timer */
+			if (dev->sighted)
+				wake = MIN(wake, dev->next_try);
+		}
+	}
+
+	if (wake != G_MAXINT64 &&
+	    (!ac->timeout || wake < ac->timeout_at)) {
+		if (ac->timeout)
+			g_source_remove(ac->timeout);
+		ac->timeout_at = wake;
+		ac->timeout = g_timeout_add(
+				MAX(wake - now, 0) / G_TIME_SPAN_MILLISECOND + 1,
+				autoconnect_timeout, ac);
+	}
+
+out_check:
+	if (ac->in_flight)
+		return;
+
+	if (!remaining || ac->connected >= ac->max_connected)
+		autoconnect_stop(ac);
+}
+
+static gboolean autoconnect_kick(gpointer data)
+{
+	struct autoconnect *ac = data;
+
+	ac->kick = 0;
+
+	if (autoconnect_load(ac)) {
+		autoconnect_run(ac);
+		return G_SOURCE_REMOVE;
+	}
+
+	/* no objects yet, i.e. BlueZ isn't up */
+	if (++ac->loads > ac->retries) {
+		AFB_WARNING("autoconnect given up, no BlueZ objects");
+		return G_SOURCE_REMOVE;
+	}
+
+	ac->kick = g_timeout_add(ac->backoff, autoconnect_kick, ac);
+
+	return G_SOURCE_REMOVE;
+}
+
+static void autoconnect_history_add(struct autoconnect *ac, const char *path)
+{
+	gchar **history, *name;
+	guint i, n = 0;
+
+	name = autoconnect_device_name(path);
+	if (!name)
+		return;
+
+	if (ac->history && ac->history[0] && !strcmp(ac->history[0], name)) {
+		g_free(name);
+		return;
+	}
+
+	history = g_new0(gchar *, AUTOCONNECT_HISTORY_MAX + 1);
+	history[n++] = name;
+
+	for (i = 0; ac->history && ac->history[i]; i++) {
+		if (n >= AUTOCONNECT_HISTORY_MAX)
+			break;
+		if (strcmp(ac->history[i], name))
+			history[n++] = g_strdup(ac->history[i]);
+	}
+
+	g_strfreev(ac->history);
+	ac->history = history;
+
+	set_conf_strv(ac->api, "autoconnect_history", ac->history);
+}
+
+/* a device was seen, i.e. it is in range */
+void bluetooth_autoconnect_sighted(struct bluetooth_state *ns,
+		const char *path)
+{
+	struct autoconnect *ac = g_atomic_pointer_get(&ns->autoconnect);
+	struct autoconnect_device *dev;
+
+	if (!ac)
+		return;
+
+	dev = autoconnect_device_lookup(ac, path);
+	if (!dev || dev->done || dev->cw || dev->sighted)
+		return;
+
+	AFB_DEBUG("autoconnect sighting of %s", dev->path);
+
+	dev->sighted = TRUE;
+	autoconnect_run(ac);
+}
+
+/* called for every device PropertiesChanged signal */
+void bluetooth_autoconnect_changed(struct bluetooth_state *ns,
+		const char *path, GVariant *changed)
+{
+	struct autoconnect *ac = g_atomic_pointer_get(&ns->autoconnect);
+	struct autoconnect_device *dev;
+	gboolean connected;
+	GVariant *rssi;
+
+	if (!ac)
+		return;
+
+	/* RSSI is only reported while the device is being received */
+	rssi = g_variant_lookup_value(changed, "RSSI", NULL);
+	if (rssi) {
+		g_variant_unref(rssi);
+		bluetooth_autoconnect_sighted(ns, path);
+	}
+
+	if (!g_variant_lookup(changed, "Connected", "b", &connected) ||
+	    !connected)
+		return;
+
+	autoconnect_history_add(ac, path);
+
+	dev = autoconnect_device_lookup(ac, path);
+	if (dev)
+		autoconnect_device_connected(ac, dev);
+}
+
+/* called from the binding init, after the configuration is read */
+void bluetooth_autoconnect_start(struct bluetooth_state *ns, afb_api_t api)
+{
+	struct autoconnect *ac;
+	guint delay;
+
+	ac = g_malloc0(sizeof(*ac));
+	ac->ns = ns;
+	ac->api = api;
+
+	delay = get_conf_uint(api, "autoconnect_delay",
+			AUTOCONNECT_DELAY_DEFAULT);
+	ac->max_connected = get_conf_uint(api, "autoconnect_max",
+			AUTOCONNECT_MAX_DEFAULT);
+	ac->retries = get_conf_uint(api, "autoconnect_retries",
+			AUTOCONNECT_RETRIES_DEFAULT);
+	ac->backoff = get_conf_uint(api, "autoconnect_backoff",
+			AUTOCONNECT_BACKOFF_DEFAULT);
+	ac->sightings = !!get_conf_uint(api, "autoconnect_sightings",
+			AUTOCONNECT_SIGHTINGS_DEFAULT);
+	ac->concurrency = g_atomic_int_get(&ns->connect_concurrency);
+	if (!ac->concurrency)
+		ac->concurrency = CONNECT_CONCURRENCY_DEFAULT;
+
+	ac->priority = get_conf_strv(api, "autoconnect_priority");
+	ac->history = get_conf_strv(api, "autoconnect_history");
+
+	g_atomic_pointer_set(&ns->autoconnect, ac);
+
+	/* the history is still kept up to date when autoconnect is off */
+	if (ac->max_connected)
+		ac->kick = g_timeout_add(delay, autoconnect_kick, ac);
+}
+
+/* called from the binding cleanup, once the main loop is gone */
+void bluetooth_autoconnect_free(struct bluetooth_state *ns)
+{
+	struct autoconnect *ac = g_atomic_pointer_get(&ns->autoconnect);
+
+	if (!ac)
+		return;
+
+	g_atomic_pointer_set(&ns->autoconnect, NULL);
+
+	if (ac->kick)
+		g_source_remove(ac->kick);
+	if (ac->timeout)
+		g_source_remove(ac->timeout);
+	/* the call work of a connect in flight isn't ours to free */
+	if (ac->devices)
+		g_ptr_array_unref(ac->devices);
+
+	g_strfreev(ac->priority);
+	g_strfreev(ac->history);
+	g_free(ac);
+}
@@ -37,68 +37,89 @@
 #include "bluetooth-api.h"
 #include "bluetooth-common.h"
 
+/* X(dbus name, json name, type), see PROPERTY_INFO() */
+#define ADAPTER_PROPERTIES(X) \
+	X(UUIDs,		uuids,			as) \
+	X(Discoverable,		discoverable,		b) \
+	X(Discovering,		discovering,		b) \
+	X(Pairable,		pairable,		b) \
+	X(Powered,		powered,		b) \
+	X(Address,		address,		s) \
+	X(AddressType,		addresstype,		s) \
+	X(DiscoverableTimeout,	discoverabletimeout,	u) \
+	X(PairableTimeout,	pairabletimeout,	u)
+
+#define DEVICE_PROPERTIES(X) \
+	X(Address,		address,		s) \
+	X(AddressType,		addresstype,		s) \
+	X(Name,			name,			s) \
+	X(Adapter,		adapter,		o) \
+	X(Alias,		alias,			s) \
+	X(Class,		class,			u) \
+	X(Icon,			icon,			s) \
+	X(Modalias,		modalias,		s) \
+	X(Paired,		paired,			b) \
+	X(Trusted,		trusted,		b) \
+	X(Blocked,		blocked,		b) \
+	X(LegacyPairing,	legacypairing,		b) \
+	X(TxPower,		txpower,		n) \
+	X(RSSI,			rssi,			n) \
+	X(Connected,		connected,		b) \
+	X(UUIDs,		uuids,			as)
+
+#define MEDIAPLAYER_TRACK_PROPERTIES(X) \
+	X(Title,		title,			s) \
+	X(Artist,		artist,			s) \
+	X(Album,		album,			s) \
+	X(Genre,		genre,			s) \
+	X(NumberOfTracks,	numberoftracks,		u) \
+	X(TrackNumber,		tracknumber,		u) \
+	X(Duration,		duration,		u)
+
+#define MEDIAPLAYER_PROPERTIES(X) \
+	X(Position,		position,		u) \
+	X(Status,		status,			s) \
+	X(Track,		track,			dict)
+
+#define MEDIATRANSPORT_PROPERTIES(X) \
+	X(UUID,			uuid,			s) \
+	X(State,		state,			s) \
+	X(Delay,		delay,			q) \
+	X(Volume,		volume,			q)
+
 static const struct property_info adapter_props[] = {
-	{ .name = "UUIDs", 		.fmt = "as", },
-	{ .name = "Discoverable",	.fmt = "b", },
-	{ .name = "Discovering",	.fmt = "b", },
-	{ .name = "Pairable",		.fmt = "b", },
-	{ .name = "Powered",		.fmt = "b", },
-	{ .name = "Address",		.fmt = "s", },
-	{ .name = "AddressType",	.fmt = "s", },
-	{ .name = "DiscoverableTimeout",.fmt = "u", },
-	{ .name = "PairableTimeout",	.fmt = "u", },
+	ADAPTER_PROPERTIES(PROPERTY_INFO)
 	{ },
 };
 
 static const struct property_info device_props[] = {
-	{ .name = "Address",		.fmt = "s", },
-	{ .name = "AddressType",	.fmt = "s", },
-	{ .name = "Name",		.fmt = "s", },
-	{ .name = "Adapter",		.fmt = "s", },
-	{ .name = "Alias",		.fmt = "s", },
-	{ .name = "Class",		.fmt = "u", },
-	{ .name = "Icon",		.fmt = "s", },
-	{ .name = "Modalias",		.fmt = "s", },
-	{ .name	= "Paired",		.fmt = "b", },
-	{ .name = "Trusted",		.fmt = "b", },
-	{ .name = "Blocked",		.fmt = "b", },
-	{ .name = "LegacyPairing",	.fmt = "b", },
-	{ .name = "TxPower",		.fmt = "n", },
-	{ .name = "RSSI",		.fmt = "n", },
-	{ .name = "Connected",		.fmt = "b", },
-	{ .name = "UUIDs",		.fmt = "as", },
-	{ .name = "Adapter",		.fmt = "s", },
+	DEVICE_PROPERTIES(PROPERTY_INFO)
+	{ },
+};
+
+static const struct property_info track_props[] = {
+	MEDIAPLAYER_TRACK_PROPERTIES(PROPERTY_INFO)
 	{ },
 };
 
 static const struct property_info mediaplayer_props[] = {
-	{ .name = "Position",		.fmt = "u", },
-	{ .name = "Status",		.fmt = "s", },
-	{
-		.name	= "Track",
-		.fmt	= "{sv}",
-		.sub	= (const struct property_info []) {
-			{ .name = "Title",	.fmt = "s", },
-			{ .name = "Artist",	.fmt = "s", },
-			{ .name = "Album",	.fmt = "s", },
-			{ .name = "Genre",	.fmt = "s", },
-			{ .name = "NumberOfTracks",	.fmt = "u", },
-			{ .name = "TrackNumber",	.fmt = "u", },
-			{ .name = "Duration",	.fmt = "u", },
-			{ },
-		},
-	},
+	MEDIAPLAYER_PROPERTIES(PROPERTY_INFO)
 	{ },
 };
 
 static const struct property_info mediatransport_props[] = {
-	{ .name = "UUID",	.fmt = "s", },
-	{ .name = "State",	.fmt = "s", },
-	{ .name = "Delay",	.fmt = "q", },
-	{ .name = "Volume",	.fmt = "q", },
+	MEDIATRANSPORT_PROPERTIES(PROPERTY_INFO)
 	{ },
 };
 
+void bluez_property_index_init(void)
+{
+	property_index_register(adapter_props);
+	property_index_register(device_props);
+	property_index_register(mediaplayer_props);
+	property_index_register(mediatransport_props);
+}
+
 const struct property_info *bluez_get_property_info(
 		const char *access_type, GError **error)
 {
@@ -118,6 +139,60 @@ const struct property_info *bluez_get_property_info(
 	return pi;
 }
 
+const char *bluez_interface_to_access_type(const char *interface)
+{
+	if (!g_strcmp0(interface, BLUEZ_ADAPTER_INTERFACE))
+		return BLUEZ_AT_ADAPTER;
+	if (!g_strcmp0(interface, BLUEZ_DEVICE_INTERFACE))
+		return BLUEZ_AT_DEVICE;
+	if (!g_strcmp0(interface, BLUEZ_MEDIAPLAYER_INTERFACE))
+		return BLUEZ_AT_MEDIAPLAYER;
+	if (!g_strcmp0(interface, BLUEZ_MEDIATRANSPORT_INTERFACE))
+		return BLUEZ_AT_MEDIATRANSPORT;
+	return NULL;
+}
+
+const char *bluez_access_type_to_interface(const char *access_type)
+{
+	if (!g_strcmp0(access_type, BLUEZ_AT_ADAPTER))
+		return BLUEZ_ADAPTER_INTERFACE;
+	if (!g_strcmp0(access_type, BLUEZ_AT_DEVICE))
+		return BLUEZ_DEVICE_INTERFACE;
+	if (!g_strcmp0(access_type, BLUEZ_AT_MEDIAPLAYER))
+		return BLUEZ_MEDIAPLAYER_INTERFACE;
+	if (!g_strcmp0(access_type, BLUEZ_AT_MEDIATRANSPORT))
+		return BLUEZ_MEDIATRANSPORT_INTERFACE;
+	if (!g_strcmp0(access_type, BLUEZ_AT_AGENT))
+		return BLUEZ_AGENT_INTERFACE;
+	return NULL;
+}
+
+/* NOTE: jprop is consumed */
+json_object *bluez_object_json(const char *access_type, const char *path,
+		json_object *jprop)
+{
+	json_object *jtype = json_object_new_object();
+	struct bluez_path bp;
+
+	bluez_path_parse(&bp, path);
+
+	if (!strcmp(access_type, BLUEZ_AT_ADAPTER)) {
+		json_object_object_add(jtype, "name",
+			bluez_path_component_json(&bp, BLUEZ_PATH_ADAPTER));
+	} else if (!strcmp(access_type, BLUEZ_AT_DEVICE)) {
+		json_process_bluez_path(jtype, &bp);
+	} else if (!strcmp(access_type, BLUEZ_AT_MEDIATRANSPORT)) {
+		json_object_object_add(jtype, "endpoint",
+			bluez_path_component_json(&bp, BLUEZ_PATH_LEAF));
+
+		json_process_bluez_path(jtype, &bp);
+	}
+
+	json_object_object_add(jtype, "properties", jprop);
+
+	return jtype;
+}
+
 gboolean bluez_property_dbus2json(const char *access_type,
 		json_object *jprop, const gchar *key, GVariant *var,
 		gboolean *is_config,
@@ -203,37 +278,43 @@ void bluez_decode_call_error(struct bluetooth_state *ns,
 	}
 }
 
-GVariant *bluez_call(struct bluetooth_state *ns,
-		const char *access_type, const char *path,
-		const char *method, GVariant *params, GError **error)
+/* object path and interface a method call of access_type goes to */
+static gboolean bluez_call_target(const char *access_type,
+		const char **path, const char **interface, GError **error)
 {
-	const char *interface;
-	GVariant *reply;
+	if (!strcmp(access_type, BLUEZ_AT_AGENTMANAGER)) {
+		*path = BLUEZ_PATH;
+		*interface = BLUEZ_AGENTMANAGER_INTERFACE;
+		return TRUE;
+	}
 
-	if (!path && (!strcmp(access_type, BLUEZ_AT_DEVICE) ||
-			  !strcmp(access_type, BLUEZ_AT_ADAPTER) ||
-			  !strcmp(access_type, BLUEZ_AT_MEDIAPLAYER))) {
+	*interface = bluez_access_type_to_interface(access_type);
+	if (!*interface || !strcmp(access_type, BLUEZ_AT_AGENT)) {
+		g_set_error(error, NB_ERROR, NB_ERROR_ILLEGAL_ARGUMENT,
+				"illegal %s argument",
+				access_type);
+		return FALSE;
+	}
+
+	if (!*path) {
 		g_set_error(error, NB_ERROR, NB_ERROR_MISSING_ARGUMENT,
 				"missing %s argument",
 				access_type);
-		return NULL;
+		return FALSE;
 	}
 
-	if (!strcmp(access_type, BLUEZ_AT_DEVICE)) {
-		interface = BLUEZ_DEVICE_INTERFACE;
-	} else if (!strcmp(access_type, BLUEZ_AT_ADAPTER)) {
-		interface = BLUEZ_ADAPTER_INTERFACE;
-	} else if (!strcmp(access_type, BLUEZ_AT_AGENTMANAGER)) {
-		path = BLUEZ_PATH;
-		interface = BLUEZ_AGENTMANAGER_INTERFACE;
-	} else if (!strcmp(access_type, BLUEZ_AT_MEDIAPLAYER)) {
-		interface = BLUEZ_MEDIAPLAYER_INTERFACE;
-	} else {
-		g_set_error(error, NB_ERROR, NB_ERROR_ILLEGAL_ARGUMENT,
-				"illegal %s argument",
-				access_type);
+	return TRUE;
+}
+
+GVariant *bluez_call(struct bluetooth_state *ns,
+		const char *access_type, const char *path,
+		const char *method, GVariant *params, GError **error)
+{
+	const char *interface;
+	GVariant *reply;
+
+	if (!bluez_call_target(access_type, &path, &interface, error))
 		return NULL;
-	}
 
 	reply = g_dbus_connection_call_sync(ns->conn,
 			BLUEZ_SERVICE, path, interface, method, params,
@@ -256,6 +337,65 @@ GVariant *bluez_call(struct bluetooth_state *ns,
 	return reply;
 }
 
+void bluez_call_pool_init(struct bluetooth_state *ns)
+{
+	g_mutex_init(&ns->cpw_mutex);
+}
+
+void bluez_call_pool_cleanup(struct bluetooth_state *ns)
+{
+	struct bluez_pending_work *cpw;
+
+	while ((cpw = ns->cpw_free)) {
+		ns->cpw_free = cpw->next_free;
+		g_object_unref(cpw->cancel);
+		g_free(cpw);
+	}
+}
+
+/* pending calls are recycled with their cancellable */
+static struct bluez_pending_work *
+bluez_call_pool_get(struct bluetooth_state *ns)
+{
+	struct bluez_pending_work *cpw;
+
+	g_mutex_lock(&ns->cpw_mutex);
+	cpw = ns->cpw_free;
+	if (cpw) {
+		ns->cpw_free = cpw->next_free;
+		ns->cpw_free_count--;
+	}
+	g_mutex_unlock(&ns->cpw_mutex);
+
+	if (cpw)
+		return cpw;
+
+	cpw = g_malloc0(sizeof(*cpw));
+	cpw->cancel = g_cancellable_new();
+
+	return cpw;
+}
+
+static void bluez_call_pool_put(struct bluetooth_state *ns,
+		struct bluez_pending_work *cpw)
+{
+	g_cancellable_reset(cpw->cancel);
+
+	g_mutex_lock(&ns->cpw_mutex);
+	if (ns->cpw_free_count < CALL_WORK_POOL_MAX) {
+		cpw->next_free = ns->cpw_free;
+		ns->cpw_free = cpw;
+		ns->cpw_free_count++;
+		cpw = NULL;
+	}
+	g_mutex_unlock(&ns->cpw_mutex);
+
+	if (cpw) {
+		g_object_unref(cpw->cancel);
+		g_free(cpw);
+	}
+}
+
 static void bluez_call_async_ready(GObject *source_object,
 		GAsyncResult *res, gpointer user_data)
 {
@@ -266,67 +406,51 @@ static void bluez_call_async_ready(GObject *source_object,
 
 	result = g_dbus_connection_call_finish(ns->conn, res, &error);
 
+	/* tell why, instead of a bare "Operation was cancelled" */
+	if (cpw->cancel_reason &&
+	    g_error_matches(error, G_IO_ERROR, G_IO_ERROR_CANCELLED)) {
+		g_clear_error(&error);
+		g_set_error(&error, NB_ERROR, NB_ERROR_CANCELED, "%s",
+				cpw->cancel_reason);
+	}
+
 	cpw->callback(cpw->user_data, result, &error);
 
 	g_clear_error(&error);
-	g_cancellable_reset(cpw->cancel);
-	g_free(cpw);
+	bluez_call_pool_put(ns, cpw);
 }
 
+/* NOTE: only until the callback ran, the cpw is recycled afterwards */
 void bluez_cancel_call(struct bluetooth_state *ns,
-		struct bluez_pending_work *cpw)
+		struct bluez_pending_work *cpw, const char *reason)
 {
+	cpw->cancel_reason = reason;
 	g_cancellable_cancel(cpw->cancel);
 }
 
-struct bluez_pending_work *
-bluez_call_async(struct bluetooth_state *ns,
-		const char *access_type, const char *type_arg,
+static struct bluez_pending_work *
+bluez_call_async_path(struct bluetooth_state *ns,
+		const char *path, const char *interface,
 		const char *method, GVariant *params, GError **error,
 		void (*callback)(void *user_data, GVariant *result, GError **error),
 		void *user_data)
 {
-	const char *path;
-	const char *interface;
 	struct bluez_pending_work *cpw;
 
-	if (!type_arg && (!strcmp(access_type, BLUEZ_AT_DEVICE) ||
-			  !strcmp(access_type, BLUEZ_AT_ADAPTER))) {
-		g_set_error(error, NB_ERROR, NB_ERROR_MISSING_ARGUMENT,
-				"missing %s argument",
-				access_type);
+	/* GDBus would drop the call without ever calling back */
+	if (!g_variant_is_object_path(path)) {
+		g_set_error(error, G_IO_ERROR, G_IO_ERROR_INVALID_ARGUMENT,
+				"invalid object path %s", path);
+		if (params)
+			g_variant_unref(g_variant_ref_sink(params));
 		return NULL;
 	}
 
-	if (!strcmp(access_type, BLUEZ_AT_DEVICE)) {
-		path = type_arg;
-		interface = BLUEZ_DEVICE_INTERFACE;
-	} else if (!strcmp(access_type, BLUEZ_AT_ADAPTER)) {
-		path = type_arg;
-		interface = BLUEZ_ADAPTER_INTERFACE;
-	} else {
-		g_set_error(error, NB_ERROR, NB_ERROR_ILLEGAL_ARGUMENT,
-				"illegal %s argument",
-				access_type);
-		return NULL;
-	}
-
-	cpw = g_malloc(sizeof(*cpw));
-	if (!cpw) {
-		g_set_error(error, NB_ERROR, NB_ERROR_OUT_OF_MEMORY,
-				"out of memory");
-		return NULL;
-	}
+	cpw = bluez_call_pool_get(ns);
 	cpw->ns = ns;
 	cpw->user_data = user_data;
-	cpw->cancel = g_cancellable_new();
-	if (!cpw->cancel) {
-		g_free(cpw);
-		g_set_error(error, NB_ERROR, NB_ERROR_OUT_OF_MEMORY,
-				"out of memory");
-		return NULL;
-	}
 	cpw->callback = callback;
+	cpw->cancel_reason = NULL;
 
 	g_dbus_connection_call(ns->conn,
 			BLUEZ_SERVICE, path, interface, method, params,
@@ -339,6 +463,141 @@ bluez_call_async(struct bluetooth_state *ns,
 	return cpw;
 }
 
+struct bluez_pending_work *
+bluez_call_async(struct bluetooth_state *ns,
+		const char *access_type, const char *type_arg,
+		const char *method, GVariant *params, GError **error,
+		void (*callback)(void *user_data, GVariant *result, GError **error),
+		void *user_data)
+{
+	const char *path = type_arg;
+	const char *interface;
+
+	if (!bluez_call_target(access_type, &path, &interface, error))
+		return NULL;
+
+	return bluez_call_async_path(ns, path, interface, method, params,
+			error, callback, user_data);
+}
+
+/* converts a Properties.GetAll reply */
+json_object *bluez_properties_json(const char *access_type,
+		GVariant *reply, GError **error)
+{
+	const struct property_info *pi;
+	json_object *jprop;
+	GVariantIter *array;
+	const gchar *key;
+	GVariant *var;
+	gboolean is_config;
+
+	pi = bluez_get_property_info(access_type, error);
+	if (!pi)
+		return NULL;
+
+	jprop = json_object_new_object();
+	g_variant_get(reply, "(a{sv})", &array);
+	while (g_variant_iter_next(array, "{&sv}", &key, &var)) {
+		root_property_dbus2json(jprop, pi, key, var, &is_config);
+		g_variant_unref(var);
+	}
+	g_variant_iter_free(array);
+
+	return jprop;
+}
+
+/*
+ * Properties.GetAll without the cache; the reply is handed to the
+ * callback as is, see bluez_properties_json().
+ */
+struct bluez_pending_work *
+bluez_get_properties_async(struct bluetooth_state *ns,
+		const char *access_type, const char *path, GError **error,
+		void (*callback)(void *user_data, GVariant *result, GError **error),
+		void *user_data)
+{
+	const char *interface;
+
+	if (!bluez_get_property_info(access_type, error))
+		return NULL;
+
+	if (!bluez_call_target(access_type, &path, &interface, error))
+		return NULL;
+
+	return bluez_call_async_path(ns, path, FREEDESKTOP_PROPERTIES, "GetAll",
+			g_variant_new("(s)", interface), error,
+			callback, user_data);
+}
+
+/* converts a GetManagedObjects reply to the managed_objects layout */
+json_object *bluez_objects_json(GVariant *reply)
+{
+	const struct property_info *pi;
+	GVariantIter *array, *array2, *array3;
+	const char *access_type, *interface, *path2 = NULL;
+	json_object *jarray, *jarray2, *jarray3;
+	json_object *jprop, *jresp, *jtype;
+	const gchar *key = NULL;
+	GVariant *var = NULL;
+	gboolean is_config;
+
+	jarray = json_object_new_array();
+	jarray2 = json_object_new_array();
+	jarray3 = json_object_new_array();
+
+	jresp = json_object_new_object();
+	json_object_object_add(jresp, "adapters", jarray);
+	json_object_object_add(jresp, "devices", jarray2);
+	json_object_object_add(jresp, "transports", jarray3);
+
+	g_variant_get(reply, "(a{oa{sa{sv}}})", &array);
+	while (g_variant_iter_loop(array, "{oa{sa{sv}}}", &path2, &array2)) {
+
+		while (g_variant_iter_loop(array2, "{&sa{sv}}", &interface, &array3)) {
+			json_object *array = NULL;
+
+			if (!strcmp(interface, BLUEZ_ADAPTER_INTERFACE)) {
+				access_type = BLUEZ_AT_ADAPTER;
+				array = jarray;
+			} else if (!strcmp(interface, BLUEZ_DEVICE_INTERFACE)) {
+				access_type = BLUEZ_AT_DEVICE;
+				array = jarray2;
+			} else if (!strcmp(interface, BLUEZ_MEDIATRANSPORT_INTERFACE)) {
+				access_type = BLUEZ_AT_MEDIATRANSPORT;
+				array = jarray3;
+		 	} else {
+				continue; /* TODO: Maybe display other interfaces */
+			}
+
+			pi = bluez_get_property_info(access_type, NULL);
+
+			/* {} when there are none, the same as the cache */
+			jprop = json_object_new_object();
+			while (g_variant_iter_loop(array3, "{sv}", &key, &var))
+				root_property_dbus2json(jprop, pi,
+					key, var, &is_config);
+
+			jtype = bluez_object_json(access_type, path2, jprop);
+			json_object_array_add(array, jtype);
+		}
+
+	}
+
+	g_variant_iter_free(array);
+
+	return jresp;
+}
+
+struct bluez_pending_work *
+bluez_get_objects_async(struct bluetooth_state *ns, GError **error,
+		void (*callback)(void *user_data, GVariant *result, GError **error),
+		void *user_data)
+{
+	return bluez_call_async_path(ns, BLUEZ_OBJECT_PATH,
+			FREEDESKTOP_OBJECTMANAGER, "GetManagedObjects",
+			NULL, error, callback, user_data);
+}
+
 json_object *bluez_get_properties(struct bluetooth_state *ns,
 		const char *access_type, const char *path,
 		GError **error)
@@ -346,13 +605,8 @@ json_object *bluez_get_properties(struct bluetooth_state *ns,
 	const struct property_info *pi = NULL;
 	const char *method = NULL;
 	GVariant *reply = NULL;
-	GVariantIter *array, *array2, *array3;
-	GVariant *var = NULL;
-	const char *interface, *interface2, *path2 = NULL;
-	const gchar *key = NULL;
-	json_object *jarray = NULL, *jarray2 = NULL, *jarray3 = NULL;
-	json_object *jprop = NULL, *jresp = NULL, *jtype = NULL;
-	gboolean is_config;
+	const char *interface, *interface2;
+	json_object *jresp = NULL;
 
 	if (!strcmp(access_type, BLUEZ_AT_DEVICE) ||
 	    !strcmp(access_type, BLUEZ_AT_MEDIAPLAYER) ||
@@ -392,6 +646,14 @@ json_object *bluez_get_properties(struct bluetooth_state *ns,
 		return NULL;
 	}
 
+	/* answer from the object cache when it knows about the object */
+	if (!strcmp(access_type, BLUEZ_AT_OBJECT))
+		jresp = bluez_cache_get_objects(ns);
+	else
+		jresp = bluez_cache_get_properties(ns, access_type, path);
+	if (jresp)
+		return jresp;
+
 	reply = g_dbus_connection_call_sync(ns->conn,
 			BLUEZ_SERVICE, path, interface, method,
 			interface2 ? g_variant_new("(s)", interface2) : NULL,
@@ -405,80 +667,10 @@ json_object *bluez_get_properties(struct bluetooth_state *ns,
 	    !strcmp(access_type, BLUEZ_AT_MEDIAPLAYER) ||
 	    !strcmp(access_type, BLUEZ_AT_MEDIATRANSPORT) ||
 	    !strcmp(access_type, BLUEZ_AT_ADAPTER)) {
-		jprop = json_object_new_object();
-		g_variant_get(reply, "(a{sv})", &array);
-		while (g_variant_iter_loop(array, "{sv}", &key, &var)) {
-			root_property_dbus2json(jprop, pi,
-					key, var, &is_config);
-		}
-		g_variant_iter_free(array);
+		jresp = bluez_properties_json(access_type, reply, error);
 		g_variant_unref(reply);
-		jresp = jprop;
 	} else if (!strcmp(access_type, BLUEZ_AT_OBJECT)) {
-		jarray = json_object_new_array();
-		jarray2 = json_object_new_array();
-		jarray3 = json_object_new_array();
-
-		jresp = json_object_new_object();
-		json_object_object_add(jresp, "adapters", jarray);
-		json_object_object_add(jresp, "devices", jarray2);
-		json_object_object_add(jresp, "transports", jarray3);
-
-		g_variant_get(reply, "(a{oa{sa{sv}}})", &array);
-		while (g_variant_iter_loop(array, "{oa{sa{sv}}}", &path2, &array2)) {
-
-			while (g_variant_iter_loop(array2, "{&sa{sv}}", &interface, &array3)) {
-				json_object *array = NULL;
-				gchar *tmp = NULL;
-
-				jtype = json_object_new_object();
-
-				if (!strcmp(interface, BLUEZ_ADAPTER_INTERFACE)) {
-					access_type = BLUEZ_AT_ADAPTER;
-					array = jarray;
-
-					tmp = bluez_return_adapter(path2);
-					json_object_object_add(jtype, "name", json_object_new_string(tmp));
-					g_free(tmp);
-				} else if (!strcmp(interface, BLUEZ_DEVICE_INTERFACE)) {
-					access_type = BLUEZ_AT_DEVICE;
-					array = jarray2;
-
-					json_process_path(jtype, path2);
-				} else if (!strcmp(interface, BLUEZ_MEDIATRANSPORT_INTERFACE)) {
-					gchar *endpoint = find_index(path2, 5);
-
-					access_type = BLUEZ_AT_MEDIATRANSPORT;
-					array = jarray3;
-
-					json_object_object_add(jtype, "endpoint",
-						json_object_new_string(endpoint));
-					g_free(endpoint);
-
-					json_process_path(jtype, path2);
-			 	} else {
-					json_object_put(jtype);
-					continue; /* TODO: Maybe display other interfaces */
-				}
-
-				pi = bluez_get_property_info(access_type, error);
-
-				while (g_variant_iter_loop(array3, "{sv}", &key, &var)) {
-					if (!jprop)
-						jprop = json_object_new_object();
-
-					root_property_dbus2json(jprop, pi,
-						key, var, &is_config);
-				}
-
-				json_object_object_add(jtype, "properties", jprop);
-				json_object_array_add(array, jtype);
-				jprop = NULL;
-			}
-
-		}
-
-		g_variant_iter_free(array);
+		jresp = bluez_objects_json(reply);
 		g_variant_unref(reply);
 	}
 
@@ -495,46 +687,86 @@ json_object *bluez_get_property(struct bluetooth_state *ns,
 		gboolean is_json_name, const char *name, GError **error)
 {
 	const struct property_info *pi;
-	json_object *jprop, *jval;
+	const char *interface;
+	json_object *jval = NULL;
+	GVariant *reply, *var;
+	gboolean is_config;
+	gchar *propname;
 
 	pi = bluez_get_property_info(access_type, error);
 	if (!pi)
 		return NULL;
 
-	jprop = bluez_get_properties(ns, access_type, path, error);
-	if (!jprop)
+	pi = property_by_name(pi, is_json_name, name, &is_config);
+	if (!pi)
+		goto out_bad;
+
+	/* a cached object has every property BlueZ reported */
+	if (!is_config &&
+	    bluez_cache_get_property(ns, access_type, path, pi, &jval)) {
+		if (!jval)
+			goto out_bad;
+		return jval;
+	}
+
+	interface = bluez_access_type_to_interface(access_type);
+	if (!interface || !path) {
+		g_set_error(error, NB_ERROR, NB_ERROR_ILLEGAL_ARGUMENT,
+				"illegal %s argument",
+				access_type);
 		return NULL;
+	}
 
-	jval = get_named_property(pi, is_json_name, name, jprop);
-	json_object_put(jprop);
+	/* only fetch (and convert) the one property */
+	propname = is_config ? configuration_dbus_name(pi->name) :
+		g_strdup(pi->name);
 
-	if (!jval)
-		g_set_error(error, NB_ERROR, NB_ERROR_BAD_PROPERTY,
-				"Bad property %s on %s%s%s", name,
-				access_type,
-				path ? "/" : "",
-				path ? path : "");
-	return jval;
+	reply = g_dbus_connection_call_sync(ns->conn,
+			BLUEZ_SERVICE, path, FREEDESKTOP_PROPERTIES, "Get",
+			g_variant_new("(ss)", interface, propname),
+			NULL, G_DBUS_CALL_FLAGS_NONE, DBUS_REPLY_TIMEOUT,
+			NULL, error);
+	g_free(propname);
+
+	if (!reply)
+		return NULL;
+
+	g_variant_get(reply, "(v)", &var);
+	jval = property_dbus2json(&pi, NULL, var, &is_config);
+	g_variant_unref(var);
+	g_variant_unref(reply);
+
+	if (jval)
+		return jval;
+
+out_bad:
+	g_set_error(error, NB_ERROR, NB_ERROR_BAD_PROPERTY,
+			"Bad property %s on %s%s%s", name,
+			access_type,
+			path ? "/" : "",
+			path ? path : "");
+	return NULL;
 }
 
-/* NOTE: jval is consumed */
-gboolean bluez_set_property(struct bluetooth_state *ns,
-		const char *access_type, const char *path,
+/*
+ * Convert a property write to its D-Bus form; returns the (sunk) value,
+ * with *interface and *propname (to be freed) set.
+ * NOTE: jval is consumed
+ */
+static GVariant *bluez_set_property_prepare(const char *access_type,
 		gboolean is_json_name, const char *name, json_object *jval,
-		GError **error)
+		const char **interface, gchar **propname, GError **error)
 {
 	const struct property_info *pi;
-	GVariant *reply, *arg;
-	const char *interface;
 	gboolean is_config;
-	gchar *propname;
-
-	g_assert(path);
+	GVariant *arg;
 
 	/* get start of properties */
 	pi = bluez_get_property_info(access_type, error);
-	if (!pi)
-		return FALSE;
+	if (!pi) {
+		json_object_put(jval);
+		return NULL;
+	}
 
 	/* get actual property */
 	pi = property_by_name(pi, is_json_name, name, &is_config);
@@ -542,7 +774,7 @@ gboolean bluez_set_property(struct bluetooth_state *ns,
 		g_set_error(error, NB_ERROR, NB_ERROR_UNKNOWN_PROPERTY,
 				"unknown property with name %s", name);
 		json_object_put(jval);
-		return FALSE;
+		return NULL;
 	}
 
 	/* convert to gvariant */
@@ -554,20 +786,41 @@ gboolean bluez_set_property(struct bluetooth_state *ns,
 
 	/* no variant? error */
 	if (!arg)
-		return FALSE;
+		return NULL;
+
+	*interface = bluez_access_type_to_interface(access_type);
+	if (!*interface) {
+		g_variant_unref(g_variant_ref_sink(arg));
+		g_set_error(error, NB_ERROR, NB_ERROR_ILLEGAL_ARGUMENT,
+				"illegal %s argument",
+				access_type);
+		return NULL;
+	}
 
 	if (!is_config)
-		propname = g_strdup(pi->name);
+		*propname = g_strdup(pi->name);
 	else
-		propname = configuration_dbus_name(pi->name);
+		*propname = configuration_dbus_name(pi->name);
 
-	if (!strcmp(access_type, BLUEZ_AT_DEVICE))
-		interface = BLUEZ_DEVICE_INTERFACE;
-	else if (!strcmp(access_type, BLUEZ_AT_ADAPTER))
-		interface = BLUEZ_ADAPTER_INTERFACE;
-	else if (!strcmp(access_type, BLUEZ_AT_AGENT))
-		interface = BLUEZ_AGENT_INTERFACE;
-	else
+	/* keep a reference for the cache write-through */
+	return g_variant_ref_sink(arg);
+}
+
+/* NOTE: jval is consumed */
+gboolean bluez_set_property(struct bluetooth_state *ns,
+		const char *access_type, const char *path,
+		gboolean is_json_name, const char *name, json_object *jval,
+		GError **error)
+{
+	GVariant *reply, *arg;
+	const char *interface;
+	gchar *propname;
+
+	g_assert(path);
+
+	arg = bluez_set_property_prepare(access_type, is_json_name, name,
+			jval, &interface, &propname, error);
+	if (!arg)
 		return FALSE;
 
 	reply = g_dbus_connection_call_sync(ns->conn,
@@ -576,6 +829,14 @@ gboolean bluez_set_property(struct bluetooth_state *ns,
 			NULL, G_DBUS_CALL_FLAGS_NONE, DBUS_REPLY_TIMEOUT,
 			NULL, error);
 
+	/*
+	 * BlueZ emits PropertiesChanged after the Set reply, so update
+	 * the cache now or a read right after the write would be stale.
+	 */
+	if (reply)
+		bluez_cache_set_property(ns, path, interface, propname, arg);
+
+	g_variant_unref(arg);
 	g_free(propname);
 
 	if (!reply)
@@ -586,51 +847,74 @@ gboolean bluez_set_property(struct bluetooth_state *ns,
 	return TRUE;
 }
 
-gboolean bluetooth_autoconnect(gpointer data)
-{
-	struct bluetooth_state *ns = data;
-	GError *error = NULL;
-	json_object *jresp, *jobj = NULL;
-        int i;
-
-	jresp = object_properties(ns, &error);
-
-	json_object_object_get_ex(jresp, "devices", &jobj);
+struct bluez_set_property_work {
+	struct bluetooth_state *ns;
+	gchar *path;
+	const char *interface;
+	gchar *propname;
+	GVariant *arg;
+	void (*callback)(void *user_data, GVariant *result, GError **error);
+	void *user_data;
+};
 
-        for (i = 0; i < json_object_array_length(jobj); i++) {
-		json_object *idx = json_object_array_get_idx(jobj, i);
-		json_object *props = NULL;
-		json_object_object_get_ex(idx, "properties", &props);
+static void bluez_set_property_ready(void *user_data,
+		GVariant *result, GError **error)
+{
+	struct bluez_set_property_work *spw = user_data;
 
-		if (props) {
-			json_object *paired = NULL;
-			json_object_object_get_ex(props, "paired", &paired);
+	/* same write-through as the synchronous version */
+	if (result)
+		bluez_cache_set_property(spw->ns, spw->path, spw->interface,
+				spw->propname, spw->arg);
 
-			if (paired && json_object_get_boolean(paired)) {
-				GVariant *reply;
-                                json_object *tmp = NULL;
-				const char *adapter, *device;
-				gchar *path;
+	spw->callback(spw->user_data, result, error);
 
-                                json_object_object_get_ex(idx, "device", &tmp);
-				device = json_object_get_string(tmp);
+	g_variant_unref(spw->arg);
+	g_free(spw->propname);
+	g_free(spw->path);
+	g_free(spw);
+}
 
-                                json_object_object_get_ex(idx, "adapter", &tmp);
-				adapter = json_object_get_string(tmp);
+/* NOTE: jval is consumed */
+struct bluez_pending_work *
+bluez_set_property_async(struct bluetooth_state *ns,
+		const char *access_type, const char *path,
+		gboolean is_json_name, const char *name, json_object *jval,
+		GError **error,
+		void (*callback)(void *user_data, GVariant *result, GError **error),
+		void *user_data)
+{
+	struct bluez_set_property_work *spw;
+	struct bluez_pending_work *cpw;
+	const char *interface;
+	gchar *propname;
+	GVariant *arg;
 
-				path = g_strconcat("/org/bluez/", adapter, "/", device, NULL);
+	g_assert(path);
 
-				reply = bluez_call(ns, "device", path, "Connect", NULL, NULL);
-				g_free(path);
+	arg = bluez_set_property_prepare(access_type, is_json_name, name,
+			jval, &interface, &propname, error);
+	if (!arg)
+		return NULL;
 
-				if (!reply)
-					continue;
-				g_variant_unref(reply);
+	spw = g_malloc0(sizeof(*spw));
+	spw->ns = ns;
+	spw->path = g_strdup(path);
+	spw->interface = interface;
+	spw->propname = propname;
+	spw->arg = arg;
+	spw->callback = callback;
+	spw->user_data = user_data;
 
-				return FALSE;
-			}
-		}
+	cpw = bluez_call_async_path(ns, path, FREEDESKTOP_PROPERTIES, "Set",
+			g_variant_new("(ssv)", interface, propname, arg),
+			error, bluez_set_property_ready, spw);
+	if (!cpw) {
+		g_variant_unref(arg);
+		g_free(propname);
+		g_free(spw->path);
+		g_free(spw);
 	}
 
-	return FALSE;
+	return cpw;
 }
@@ -0,0 +1,506 @@
+/*
+ * Copyright 2019 Konsulko Group
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <errno.h>
+
+#include <glib.h>
+#include <stdlib.h>
+#include <gio/gio.h>
+#include <glib-object.h>
+
+#include <json-c/json.h>
+
+#define AFB_BINDING_VERSION 3
+#include <afb/afb-binding.h>
+
+#include "bluetooth-api.h"
+#include "bluetooth-common.h"
+
+/*
+ * Shadow copy of the BlueZ adapters, devices and transports.
+ *
+ * Seeded with a single GetManagedObjects call and kept current from
+ * the InterfacesAdded, InterfacesRemoved and PropertiesChanged signals,
+ * so that read verbs never have to do a D-Bus round-trip.
+ *
+ * Property values are kept as GVariants in the same order as the
+ * respective property_info table; unknown properties are dropped.
+ *
+ * Every object also keeps its managed_objects entry as a json object;
+ * the entry is dropped whenever a property changes and rebuilt on the
+ * next read, so a reply only has to copy the entries.
+ */
+struct bluez_object {
+	gchar *path;
+	const char *access_type;
+	const struct property_info *pi;
+	guint n_props;
+	GVariant **props;
+	json_object *entry;
+};
+
+static struct bluez_object *bluez_object_new(const char *path,
+		const char *access_type)
+{
+	const struct property_info *pi;
+	struct bluez_object *obj;
+	guint n = 0;
+
+	pi = bluez_get_property_info(access_type, NULL);
+	if (!pi)
+		return NULL;
+
+	while (pi[n].name)
+		n++;
+
+	obj = g_malloc0(sizeof(*obj));
+	obj->path = g_strdup(path);
+	obj->access_type = access_type;
+	obj->pi = pi;
+	obj->n_props = n;
+	obj->props = g_malloc0(sizeof(GVariant *) * n);
+
+	return obj;
+}
+
+static void bluez_object_free(gpointer data)
+{
+	struct bluez_object *obj = data;
+	guint i;
+
+	for (i = 0; i < obj->n_props; i++) {
+		if (obj->props[i])
+			g_variant_unref(obj->props[i]);
+	}
+	if (obj->entry)
+		json_object_put(obj->entry);
+	g_free(obj->props);
+	g_free(obj->path);
+	g_free(obj);
+}
+
+static void bluez_object_set(struct bluez_object *obj,
+		const gchar *name, GVariant *value)
+{
+	const struct property_info *pi;
+	gboolean is_config;
+	guint idx;
+
+	pi = property_by_dbus_name(obj->pi, name, &is_config);
+	if (!pi || is_config)
+		return;
+
+	idx = pi - obj->pi;
+	if (obj->props[idx])
+		g_variant_unref(obj->props[idx]);
+	obj->props[idx] = value ? g_variant_ref(value) : NULL;
+
+	if (obj->entry) {
+		json_object_put(obj->entry);
+		obj->entry = NULL;
+	}
+}
+
+/* props is an a{sv} */
+static void bluez_object_update(struct bluez_object *obj, GVariant *props)
+{
+	GVariantIter iter;
+	const gchar *name;
+	GVariant *value;
+
+	g_variant_iter_init(&iter, props);
+	while (g_variant_iter_next(&iter, "{&sv}", &name, &value)) {
+		bluez_object_set(obj, name, value);
+		g_variant_unref(value);
+	}
+}
+
+static json_object *bluez_object_properties(struct bluez_object *obj)
+{
+	json_object *jprop = json_object_new_object();
+	gboolean is_config;
+	guint i;
+
+	for (i = 0; i < obj->n_props; i++) {
+		if (!obj->props[i])
+			continue;
+		root_property_dbus2json(jprop, obj->pi, obj->pi[i].name,
+				obj->props[i], &is_config);
+	}
+
+	return jprop;
+}
+
+/* a copy of the managed_objects entry; with the cache lock held */
+static json_object *bluez_object_entry(struct bluez_object *obj)
+{
+	if (!obj->entry)
+		obj->entry = bluez_object_json(obj->access_type, obj->path,
+				bluez_object_properties(obj));
+
+	return json_object_copy(obj->entry);
+}
+
+static gboolean bluez_object_get_boolean(struct bluez_object *obj,
+		const gchar *name)
+{
+	const struct property_info *pi;
+	gboolean is_config;
+	GVariant *value;
+
+	pi = property_by_dbus_name(obj->pi, name, &is_config);
+	if (!pi || is_config)
+		return FALSE;
+
+	value = obj->props[pi - obj->pi];
+	if (!value || !g_variant_is_of_type(value, G_VARIANT_TYPE_BOOLEAN))
+		return FALSE;
+
+	return g_variant_get_boolean(value);
+}
+
+static gint bluez_object_compare(gconstpointer a, gconstpointer b)
+{
+	const struct bluez_object *obj_a = a, *obj_b = b;
+
+	return strcmp(obj_a->path, obj_b->path);
+}
+
+/* ifaces is an a{sa{sv}}; must be called with the cache lock held */
+static void bluez_cache_add_unlocked(struct bluetooth_state *ns,
+		const char *path, GVariant *ifaces)
+{
+	struct bluez_object *obj;
+	const char *access_type;
+	const gchar *interface;
+	GVariantIter iter;
+	GVariant *props;
+
+	g_variant_iter_init(&iter, ifaces);
+	while (g_variant_iter_next(&iter, "{&s@a{sv}}", &interface, &props)) {
+		access_type = bluez_interface_to_access_type(interface);
+
+		/* only adapters, devices and transports are cached */
+		if (!access_type || !strcmp(access_type, BLUEZ_AT_MEDIAPLAYER)) {
+			g_variant_unref(props);
+			continue;
+		}
+
+		obj = g_hash_table_lookup(ns->cache_objects, path);
+		if (!obj || strcmp(obj->access_type, access_type)) {
+			obj = bluez_object_new(path, access_type);
+			g_hash_table_replace(ns->cache_objects, obj->path, obj);
+		}
+
+		bluez_object_update(obj, props);
+		g_variant_unref(props);
+	}
+}
+
+void bluez_cache_init(struct bluetooth_state *ns)
+{
+	g_mutex_init(&ns->cache_mutex);
+	ns->cache_objects = g_hash_table_new_full(g_str_hash, g_str_equal,
+			NULL, bluez_object_free);
+	ns->cache_valid = FALSE;
+}
+
+void bluez_cache_cleanup(struct bluetooth_state *ns)
+{
+	g_hash_table_destroy(ns->cache_objects);
+	ns->cache_objects = NULL;
+	ns->cache_valid = FALSE;
+}
+
+void bluez_cache_clear(struct bluetooth_state *ns)
+{
+	g_mutex_lock(&ns->cache_mutex);
+	g_hash_table_remove_all(ns->cache_objects);
+	ns->cache_valid = FALSE;
+	g_mutex_unlock(&ns->cache_mutex);
+}
+
+gboolean bluez_cache_is_valid(struct bluetooth_state *ns)
+{
+	gboolean valid;
+
+	g_mutex_lock(&ns->cache_mutex);
+	valid = ns->cache_valid;
+	g_mutex_unlock(&ns->cache_mutex);
+
+	return valid;
+}
+
+gboolean bluez_cache_seed(struct bluetooth_state *ns, GError **error)
+{
+	GVariant *reply, *ifaces;
+	GVariantIter *array;
+	const gchar *path;
+	guint count;
+
+	reply = g_dbus_connection_call_sync(ns->conn,
+			BLUEZ_SERVICE, BLUEZ_OBJECT_PATH,
+			FREEDESKTOP_OBJECTMANAGER, "GetManagedObjects",
+			NULL, NULL, G_DBUS_CALL_FLAGS_NONE, DBUS_REPLY_TIMEOUT,
+			NULL, error);
+	if (!reply)
+		return FALSE;
+
+	g_mutex_lock(&ns->cache_mutex);
+
+	g_hash_table_remove_all(ns->cache_objects);
+
+	g_variant_get(reply, "(a{oa{sa{sv}}})", &array);
+	while (g_variant_iter_next(array, "{&o@a{sa{sv}}}", &path, &ifaces)) {
+		bluez_cache_add_unlocked(ns, path, ifaces);
+		g_variant_unref(ifaces);
+	}
+	g_variant_iter_free(array);
+
+	ns->cache_valid = TRUE;
+	count = g_hash_table_size(ns->cache_objects);
+
+	g_mutex_unlock(&ns->cache_mutex);
+
+	g_variant_unref(reply);
+
+	AFB_INFO("object cache seeded with %u objects", count);
+
+	return TRUE;
+}
+
+void bluez_cache_interfaces_added(struct bluetooth_state *ns,
+		const char *path, GVariant *ifaces)
+{
+	g_mutex_lock(&ns->cache_mutex);
+	bluez_cache_add_unlocked(ns, path, ifaces);
+	g_mutex_unlock(&ns->cache_mutex);
+}
+
+void bluez_cache_interfaces_removed(struct bluetooth_state *ns,
+		const char *path, GVariant *ifaces)
+{
+	struct bluez_object *obj;
+	const gchar *interface;
+	GVariantIter iter;
+
+	g_mutex_lock(&ns->cache_mutex);
+
+	obj = g_hash_table_lookup(ns->cache_objects, path);
+	if (obj) {
+		g_variant_iter_init(&iter, ifaces);
+		while (g_variant_iter_next(&iter, "&s", &interface)) {
+			if (!g_strcmp0(bluez_interface_to_access_type(interface),
+					obj->access_type)) {
+				g_hash_table_remove(ns->cache_objects, path);
+				break;
+			}
+		}
+	}
+
+	g_mutex_unlock(&ns->cache_mutex);
+}
+
+void bluez_cache_properties_changed(struct bluetooth_state *ns,
+		const char *path, const char *interface,
+		GVariant *changed, GVariant *invalidated)
+{
+	struct bluez_object *obj;
+	const gchar *name;
+	GVariantIter iter;
+
+	g_mutex_lock(&ns->cache_mutex);
+
+	obj = g_hash_table_lookup(ns->cache_objects, path);
+	if (obj && !g_strcmp0(bluez_interface_to_access_type(interface),
+			obj->access_type)) {
+		bluez_object_update(obj, changed);
+
+		g_variant_iter_init(&iter, invalidated);
+		while (g_variant_iter_next(&iter, "&s", &name))
+			bluez_object_set(obj, name, NULL);
+	}
+
+	g_mutex_unlock(&ns->cache_mutex);
+}
+
+void bluez_cache_set_property(struct bluetooth_state *ns,
+		const char *path, const char *interface,
+		const char *name, GVariant *value)
+{
+	struct bluez_object *obj;
+
+	g_mutex_lock(&ns->cache_mutex);
+
+	obj = g_hash_table_lookup(ns->cache_objects, path);
+	if (obj && !g_strcmp0(bluez_interface_to_access_type(interface),
+			obj->access_type))
+		bluez_object_set(obj, name, value);
+
+	g_mutex_unlock(&ns->cache_mutex);
+}
+
+json_object *bluez_cache_get_objects(struct bluetooth_state *ns)
+{
+	json_object *jresp, *jarray, *jarray2, *jarray3, *array;
+	struct bluez_object *obj;
+	GList *objects, *l;
+
+	g_mutex_lock(&ns->cache_mutex);
+
+	if (!ns->cache_valid) {
+		g_mutex_unlock(&ns->cache_mutex);
+		return NULL;
+	}
+
+	/* keep a stable (path) order like GetManagedObjects would */
+	objects = g_list_sort(g_hash_table_get_values(ns->cache_objects),
+			bluez_object_compare);
+
+	jarray = json_object_new_array();
+	jarray2 = json_object_new_array();
+	jarray3 = json_object_new_array();
+
+	jresp = json_object_new_object();
+	json_object_object_add(jresp, "adapters", jarray);
+	json_object_object_add(jresp, "devices", jarray2);
+	json_object_object_add(jresp, "transports", jarray3);
+
+	for (l = objects; l; l = l->next) {
+		obj = l->data;
+
+		if (!strcmp(obj->access_type, BLUEZ_AT_ADAPTER))
+			array = jarray;
+		else if (!strcmp(obj->access_type, BLUEZ_AT_DEVICE))
+			array = jarray2;
+		else
+			array = jarray3;
+
+		json_object_array_add(array, bluez_object_entry(obj));
+	}
+	g_list_free(objects);
+
+	g_mutex_unlock(&ns->cache_mutex);
+
+	return jresp;
+}
+
+json_object *bluez_cache_get_properties(struct bluetooth_state *ns,
+		const char *access_type, const char *path)
+{
+	struct bluez_object *obj;
+	json_object *jprop = NULL;
+
+	if (!path)
+		return NULL;
+
+	g_mutex_lock(&ns->cache_mutex);
+
+	obj = ns->cache_valid ?
+		g_hash_table_lookup(ns->cache_objects, path) : NULL;
+	if (obj && !strcmp(obj->access_type, access_type))
+		jprop = bluez_object_properties(obj);
+
+	g_mutex_unlock(&ns->cache_mutex);
+
+	return jprop;
+}
+
+/*
+ * Single property read; pi is the entry in the access_type table.
+ * Returns FALSE when the object is not cached, otherwise *jval is the
+ * property value, or NULL when BlueZ didn't report it.
+ */
+gboolean bluez_cache_get_property(struct bluetooth_state *ns,
+		const char *access_type, const char *path,
+		const struct property_info *pi, json_object **jval)
+{
+	struct bluez_object *obj;
+	gboolean is_config;
+	gboolean found = FALSE;
+	guint idx;
+
+	*jval = NULL;
+
+	if (!path)
+		return FALSE;
+
+	g_mutex_lock(&ns->cache_mutex);
+
+	obj = ns->cache_valid ?
+		g_hash_table_lookup(ns->cache_objects, path) : NULL;
+	if (obj && !strcmp(obj->access_type, access_type)) {
+		found = TRUE;
+		idx = pi - obj->pi;
+		if (idx < obj->n_props && obj->props[idx])
+			*jval = property_dbus2json(&pi, NULL,
+					obj->props[idx], &is_config);
+	}
+
+	g_mutex_unlock(&ns->cache_mutex);
+
+	return found;
+}
+
+/*
+ * Paths of the paired but not connected devices, in path order, and
+ * the number of connected devices; NULL when the cache isn't seeded.
+ */
+gchar **bluez_cache_get_paired_devices(struct bluetooth_state *ns,
+		guint *connected)
+{
+	struct bluez_object *obj;
+	GPtrArray *paths;
+	GList *objects, *l;
+
+	*connected = 0;
+
+	g_mutex_lock(&ns->cache_mutex);
+
+	if (!ns->cache_valid) {
+		g_mutex_unlock(&ns->cache_mutex);
+		return NULL;
+	}
+
+	paths = g_ptr_array_new();
+
+	objects = g_list_sort(g_hash_table_get_values(ns->cache_objects),
+			bluez_object_compare);
+
+	for (l = objects; l; l = l->next) {
+		obj = l->data;
+
+		if (strcmp(obj->access_type, BLUEZ_AT_DEVICE))
+			continue;
+
+		if (bluez_object_get_boolean(obj, "Connected"))
+			(*connected)++;
+		else if (bluez_object_get_boolean(obj, "Paired"))
+			g_ptr_array_add(paths, g_strdup(obj->path));
+	}
+	g_list_free(objects);
+
+	g_mutex_unlock(&ns->cache_mutex);
+
+	g_ptr_array_add(paths, NULL);
+
+	return (gchar **)g_ptr_array_free(paths, FALSE);
+}
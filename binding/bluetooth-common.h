@@ -33,24 +33,65 @@
 #include <afb/afb-binding.h>
 
 struct call_work;
+struct bluez_pending_work;
+struct autoconnect;
+
+/* recycled call_work and bluez_pending_work kept at most */
+#define CALL_WORK_POOL_MAX	16
+
+/* how often (s) pending operations are checked against their deadline */
+#define CALL_WORK_REAPER_INTERVAL	1
+
+/* InterfacesAdded, InterfacesRemoved and one PropertiesChanged per interface */
+#define BLUEZ_SIGNAL_SUBS	6
 
 struct bluetooth_state {
 	GMainLoop *loop;
 	GDBusConnection *conn;
-	guint device_sub;
+	guint device_sub[BLUEZ_SIGNAL_SUBS];
 	guint autoconnect_sub;
+	guint bluez_watch;
+
+	/* device_changes coalescing, main loop thread only (window in ms) */
+	GHashTable *device_changes_pending;
+	gint device_changes_window;
+
+	/* RSSI hysteresis (dBm) and rate limit (ms), main loop thread only */
+	GHashTable *rssi_reported;
+	gint rssi_threshold;
+	gint rssi_interval;
+
+	/* parallel Connect calls per connect_devices request and autoconnect */
+	gint connect_concurrency;
+
+	/* startup autoconnect, see bluetooth-autoconnect.c */
+	struct autoconnect *autoconnect;
 
 	afb_event_t adapter_changes_event;
 	afb_event_t device_changes_event;
 	afb_event_t media_event;
 	afb_event_t agent_event;
 
-	/* NOTE: single connection allowed for now */
-	/* NOTE: needs locking and a list */
+	/* non-zero while an event may have listeners, see event_listened() */
+	gint adapter_changes_listened;
+	gint device_changes_listened;
+	gint media_listened;
+
+	/* pending call work, by id and by (access_type, type_arg, method) */
 	GMutex cw_mutex;
 	int next_cw_id;
-	GSList *cw_pending;
-	struct call_work *cw;
+	GHashTable *cw_by_id;
+	GHashTable *cw_by_op;
+
+	/* recycled call work, protected by cw_mutex */
+	struct call_work *cw_free;
+	guint cw_free_count;
+	guint cw_reaper;
+
+	/* recycled pending calls, with their cancellables */
+	GMutex cpw_mutex;
+	struct bluez_pending_work *cpw_free;
+	guint cpw_free_count;
 
 	/* agent */
 	GDBusNodeInfo *introspection_data;
@@ -59,13 +100,34 @@ struct bluetooth_state {
 	gchar *agent_path;
 	gboolean agent_registered;
 
+	/* pairing sessions by device, most recent first; under cw_mutex */
+	GSList *pairing_sessions;
+	gint pairing_timeout;	/* ms */
+
 	/* mediaplayer */
+	GMutex mediaplayer_mutex;
 	gchar *mediaplayer_path;
 
-	/* adapter */
-	gchar *default_adapter;
+	/*
+	 * adapter; interned, so readers just load the pointer without any
+	 * lock, see bluetooth_get_default_adapter(). Writers (and the
+	 * persistence update) are serialized by default_adapter_mutex.
+	 */
+	GMutex default_adapter_mutex;
+	const gchar *default_adapter;
+
+	/* object cache */
+	GMutex cache_mutex;
+	GHashTable *cache_objects;
+	gboolean cache_valid;
 };
 
+static inline const gchar *bluetooth_get_default_adapter(
+		struct bluetooth_state *ns)
+{
+	return g_atomic_pointer_get(&ns->default_adapter);
+}
+
 struct init_data {
 	GCond cond;
 	GMutex mutex;
@@ -78,19 +140,25 @@ struct init_data {
 struct agent_data {
 	int pin_code;
 	gchar *device_path;
+	guint timeout;		/* pairing session timeout source */
 };
 
+/* access_type, method and bluez_method are interned, see g_intern_string() */
 struct call_work {
 	struct bluetooth_state *ns;
 	int id;
-	gchar *access_type;
+	const gchar *access_type;
 	gchar *type_arg;
-	gchar *method;
-	gchar *bluez_method;
+	const gchar *method;
+	const gchar *bluez_method;
 	struct bluez_pending_work *cpw;
 	afb_req_t request;
+	GSList *waiters;	/* requests sharing the reply of a read */
 	struct agent_data agent_data;
 	GDBusMethodInvocation *invocation;
+	gint64 start_time;	/* monotonic, for the reaper */
+	gboolean canceled;
+	struct call_work *next_free;	/* while in the ns->cw_free pool */
 };
 
 /* init methods in bluetooth-rfkill.c */
@@ -103,10 +171,75 @@ int bluetooth_register_agent(struct init_data *id);
 
 void bluetooth_unregister_agent(struct bluetooth_state *ns);
 
+/* pairing confirmations are rejected if not answered in time (ms) */
+#define PAIRING_TIMEOUT_DEFAULT		30000
+
+struct call_work *pairing_session_lookup_unlocked(struct bluetooth_state *ns,
+		const char *device_path);
+void pairing_session_end_unlocked(struct call_work *cw);
+
 /* conf methods in bluetooth-conf.c */
 
 gchar *get_default_adapter(afb_api_t api);
 int set_default_adapter(afb_api_t api, const char *adapter);
+guint get_conf_uint(afb_api_t api, const char *key, guint def);
+gchar **get_conf_strv(afb_api_t api, const char *key);
+void set_conf_strv(afb_api_t api, const char *key, gchar **strv);
+
+/* device_changes coalescing is off unless configured */
+#define DEVICE_CHANGES_WINDOW_DEFAULT	0
+
+/* RSSI filtering is off unless configured */
+#define RSSI_THRESHOLD_DEFAULT		0
+#define RSSI_INTERVAL_DEFAULT		0
+
+/* connect_devices runs this many Connect calls at once by default */
+#define CONNECT_CONCURRENCY_DEFAULT	2
+#define CONNECT_CONCURRENCY_MAX		8
+
+/* autoconnect methods in bluetooth-autoconnect.c */
+
+/* delay and backoff are in ms */
+#define AUTOCONNECT_DELAY_DEFAULT	5000
+#define AUTOCONNECT_MAX_DEFAULT		1
+#define AUTOCONNECT_RETRIES_DEFAULT	3
+#define AUTOCONNECT_BACKOFF_DEFAULT	2000
+#define AUTOCONNECT_SIGHTINGS_DEFAULT	1
+
+void bluetooth_autoconnect_start(struct bluetooth_state *ns, afb_api_t api);
+void bluetooth_autoconnect_free(struct bluetooth_state *ns);
+void bluetooth_autoconnect_changed(struct bluetooth_state *ns,
+		const char *path, GVariant *changed);
+void bluetooth_autoconnect_sighted(struct bluetooth_state *ns,
+		const char *path);
+
+/* object cache methods in bluetooth-cache.c */
+
+void bluez_cache_init(struct bluetooth_state *ns);
+void bluez_cache_cleanup(struct bluetooth_state *ns);
+void bluez_cache_clear(struct bluetooth_state *ns);
+gboolean bluez_cache_is_valid(struct bluetooth_state *ns);
+gboolean bluez_cache_seed(struct bluetooth_state *ns, GError **error);
+
+void bluez_cache_interfaces_added(struct bluetooth_state *ns,
+		const char *path, GVariant *ifaces);
+void bluez_cache_interfaces_removed(struct bluetooth_state *ns,
+		const char *path, GVariant *ifaces);
+void bluez_cache_properties_changed(struct bluetooth_state *ns,
+		const char *path, const char *interface,
+		GVariant *changed, GVariant *invalidated);
+void bluez_cache_set_property(struct bluetooth_state *ns,
+		const char *path, const char *interface,
+		const char *name, GVariant *value);
+
+json_object *bluez_cache_get_objects(struct bluetooth_state *ns);
+json_object *bluez_cache_get_properties(struct bluetooth_state *ns,
+		const char *access_type, const char *path);
+gboolean bluez_cache_get_property(struct bluetooth_state *ns,
+		const char *access_type, const char *path,
+		const struct property_info *pi, json_object **jval);
+gchar **bluez_cache_get_paired_devices(struct bluetooth_state *ns,
+		guint *connected);
 
 /* utility methods in bluetooth-util.c */
 
@@ -125,6 +258,7 @@ json_object *simple_gvariant_to_json(GVariant *var, json_object *parent,
 
 void json_process_path(json_object *jresp, const char *path);
 
+gchar *bluez_device_path(const char *adapter, const char *device);
 gchar *return_bluez_path(afb_req_t request);
 
 gchar **json_array_to_strv(json_object *jobj);
@@ -141,10 +275,52 @@ struct property_info {
 	const char *fmt;
 	unsigned int flags;
 	const struct property_info *sub;
+	/* type-checked fast paths (if NULL interpret fmt) */
+	json_object *(*dbus2json)(const struct property_info *pi,
+			GVariant *var);
 };
 
 #define PI_CONFIG	(1U << 0)
 
+/*
+ * Generates the property_info entry of an X-macro property list item
+ * X(dbus name, json name, type), e.g. X(Powered, powered, b), with the
+ * converters of its type bound in. The json name is spelled out as
+ * key_dbus_to_json() would convert it; a dict type X(Track, track, dict)
+ * takes its sub properties from track_props.
+ */
+#define PROPERTY_INFO(_name, _json, _type) \
+	{ .name = #_name, .json_name = #_json, PI_TYPE_##_type(_json) },
+
+#define PI_CONVERTERS(_type) \
+	.dbus2json = property_dbus2json_##_type
+
+#define PI_TYPE_b(_json)	.fmt = "b", PI_CONVERTERS(b)
+#define PI_TYPE_n(_json)	.fmt = "n", PI_CONVERTERS(n)
+#define PI_TYPE_q(_json)	.fmt = "q", PI_CONVERTERS(q)
+#define PI_TYPE_u(_json)	.fmt = "u", PI_CONVERTERS(u)
+#define PI_TYPE_s(_json)	.fmt = "s", PI_CONVERTERS(s)
+#define PI_TYPE_o(_json)	.fmt = "o", PI_CONVERTERS(o)
+#define PI_TYPE_as(_json)	.fmt = "as", PI_CONVERTERS(as)
+#define PI_TYPE_dict(_json)	.fmt = "{sv}", PI_CONVERTERS(dict), \
+				.sub = _json##_props
+
+#define PROPERTY_CONVERTERS_DECLARE(_type) \
+	json_object *property_dbus2json_##_type( \
+			const struct property_info *pi, GVariant *var);
+
+PROPERTY_CONVERTERS_DECLARE(b)
+PROPERTY_CONVERTERS_DECLARE(n)
+PROPERTY_CONVERTERS_DECLARE(q)
+PROPERTY_CONVERTERS_DECLARE(u)
+PROPERTY_CONVERTERS_DECLARE(s)
+PROPERTY_CONVERTERS_DECLARE(o)
+PROPERTY_CONVERTERS_DECLARE(as)
+PROPERTY_CONVERTERS_DECLARE(dict)
+
+void property_index_register(const struct property_info *pi);
+const gchar *property_json_name(const struct property_info *pi);
+
 const struct property_info *property_by_dbus_name(
 		const struct property_info *pi,
 		const gchar *dbus_name,
@@ -201,6 +377,7 @@ typedef enum {
 	NB_ERROR_MISSING_ARGUMENT,
 	NB_ERROR_ILLEGAL_ARGUMENT,
 	NB_ERROR_CALL_IN_PROGRESS,
+	NB_ERROR_CANCELED,
 } NBError;
 
 #define NB_ERROR (nb_error_quark())
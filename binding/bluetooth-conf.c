@@ -69,3 +69,104 @@ int set_default_adapter(afb_api_t api, const char *adapter)
 
 	return ret;
 }
+
+/* the value is a JSON integer or a string of one; anything else is def */
+guint get_conf_uint(afb_api_t api, const char *key, guint def)
+{
+	json_object *response, *query, *val;
+	guint value = def;
+	const char *str;
+	gchar *end;
+	gint64 v;
+	int ret;
+
+	query = json_object_new_object();
+	json_object_object_add(query, "key", json_object_new_string(key));
+
+	ret = afb_api_call_sync(api, "persistence", "read", query, &response, NULL, NULL);
+	if (ret < 0)
+		return def;
+
+	if (!json_object_object_get_ex(response, "value", &val) || !val) {
+		json_object_put(response);
+		return def;
+	}
+
+	if (json_object_is_type(val, json_type_int)) {
+		v = json_object_get_int64(val);
+	} else if (json_object_is_type(val, json_type_string)) {
+		str = json_object_get_string(val);
+		errno = 0;
+		v = g_ascii_strtoll(str, &end, 10);
+		if (errno || end == str || *end)
+			v = -1;
+	} else {
+		v = -1;
+	}
+
+	if (v >= 0 && v <= G_MAXUINT)
+		value = v;
+	else
+		AFB_WARNING("Invalid %s value, using %u", key, def);
+	json_object_put(response);
+
+	return value;
+}
+
+/* the value is a JSON array of strings, or the same as a JSON string */
+gchar **get_conf_strv(afb_api_t api, const char *key)
+{
+	json_object *response, *query, *val, *jparsed = NULL;
+	gchar **strv = NULL;
+	int ret;
+
+	query = json_object_new_object();
+	json_object_object_add(query, "key", json_object_new_string(key));
+
+	ret = afb_api_call_sync(api, "persistence", "read", query, &response, NULL, NULL);
+	if (ret < 0)
+		return NULL;
+
+	if (json_object_object_get_ex(response, "value", &val) &&
+	    json_object_is_type(val, json_type_string)) {
+		jparsed = json_tokener_parse(json_object_get_string(val));
+		val = jparsed;
+	}
+
+	if (json_object_is_type(val, json_type_array))
+		strv = json_array_to_strv(val);
+
+	json_object_put(jparsed);
+	json_object_put(response);
+
+	return strv;
+}
+
+static void set_conf_callback(void *closure, json_object *response,
+		const char *error, const char *info, afb_api_t api)
+{
+	gchar *key = closure;
+
+	if (error)
+		AFB_WARNING("Unable to store %s: %s", key, error);
+	g_free(key);
+}
+
+/* asynchronous, so it can be used from the main loop thread */
+void set_conf_strv(afb_api_t api, const char *key, gchar **strv)
+{
+	json_object *query, *jarray;
+
+	jarray = json_object_new_array();
+	for (; strv && *strv; strv++)
+		json_object_array_add(jarray, json_object_new_string(*strv));
+
+	query = json_object_new_object();
+	json_object_object_add(query, "key", json_object_new_string(key));
+	json_object_object_add(query, "value",
+			json_object_new_string(json_object_to_json_string(jarray)));
+	json_object_put(jarray);
+
+	afb_api_call(api, "persistence", "update", query,
+			set_conf_callback, g_strdup(key));
+}
@@ -307,6 +307,112 @@ json_object *simple_gvariant_to_json(GVariant *var, json_object *parent,
 	return obj;
 }
 
+/*
+ * Lookup indexes for the property_info tables.
+ *
+ * Built once at init time by property_index_register() and read-only
+ * afterwards, so lookups need neither locking nor allocations.
+ * Tables that were never registered fall back to a linear scan.
+ */
+struct property_index {
+	GHashTable *by_dbus_name;
+	GHashTable *by_json_name;
+};
+
+/* property table -> struct property_index */
+static GHashTable *property_indexes;
+/* property entry -> precomputed json name */
+static GHashTable *property_json_names;
+
+void property_index_register(const struct property_info *pi)
+{
+	const struct property_info *pit;
+	struct property_index *idx;
+	gchar *json_name;
+
+	if (!property_indexes) {
+		property_indexes = g_hash_table_new(g_direct_hash,
+				g_direct_equal);
+		property_json_names = g_hash_table_new(g_direct_hash,
+				g_direct_equal);
+	}
+
+	if (g_hash_table_contains(property_indexes, pi))
+		return;
+
+	idx = g_malloc0(sizeof(*idx));
+	idx->by_dbus_name = g_hash_table_new(g_str_hash, g_str_equal);
+	idx->by_json_name = g_hash_table_new_full(g_str_hash, g_str_equal,
+			NULL, g_free);
+
+	for (pit = pi; pit->name; pit++) {
+		/* first entry wins, just like the linear scan */
+		if (g_hash_table_contains(idx->by_dbus_name, pit->name))
+			continue;
+
+		json_name = property_name_dbus2json(pit, FALSE);
+		g_hash_table_insert(idx->by_dbus_name,
+				(gpointer)pit->name, (gpointer)pit);
+		g_hash_table_insert(idx->by_json_name,
+				json_name, (gpointer)pit);
+		g_hash_table_insert(property_json_names,
+				(gpointer)pit, json_name);
+
+		if (pit->sub)
+			property_index_register(pit->sub);
+	}
+
+	g_hash_table_insert(property_indexes, (gpointer)pi, idx);
+}
+
+const gchar *property_json_name(const struct property_info *pi)
+{
+	if (pi->json_name)
+		return pi->json_name;
+
+	if (!property_json_names)
+		return NULL;
+
+	return g_hash_table_lookup(property_json_names, pi);
+}
+
+static const struct property_info *property_index_find(GHashTable *names,
+		const gchar *name, const gchar *config_suffix,
+		gboolean *is_config)
+{
+	const struct property_info *pit;
+	const gchar *suffix;
+	gchar *tmpname;
+	size_t len;
+
+	/* direct match first */
+	pit = g_hash_table_lookup(names, name);
+	if (pit) {
+		if (is_config)
+			*is_config = FALSE;
+		return pit;
+	}
+
+	/* try to see if a matching config property exists */
+	suffix = strrchr(name, '.');
+	if (!suffix || g_ascii_strcasecmp(suffix, config_suffix))
+		return NULL;
+
+	/* it's a (possible) .config property */
+	len = suffix - name;
+	tmpname = alloca(len + 1);
+	memcpy(tmpname, name, len);
+	tmpname[len] = '\0';
+
+	pit = g_hash_table_lookup(names, tmpname);
+	if (!pit || !(pit->flags & PI_CONFIG))
+		return NULL;
+
+	if (is_config)
+		*is_config = TRUE;
+	return pit;
+}
+
 gchar *property_name_dbus2json(const struct property_info *pi,
 		gboolean is_config)
 {
@@ -331,6 +437,119 @@ gchar *property_name_dbus2json(const struct property_info *pi,
 	return cfgname;
 }
 
+/*
+ * The converters bound to the PROPERTY_INFO() entries; unlike the fmt
+ * interpreting fallback they check the value is of the declared type,
+ * and drop it otherwise.
+ */
+static gboolean property_type_check(const struct property_info *pi,
+		GVariant *var, const GVariantType *type)
+{
+	if (g_variant_is_of_type(var, type))
+		return TRUE;
+
+	AFB_WARNING("%s property is '%s', expected '%s'", pi->name,
+			g_variant_get_type_string(var), pi->fmt);
+	return FALSE;
+}
+
+json_object *property_dbus2json_b(const struct property_info *pi,
+		GVariant *var)
+{
+	if (!property_type_check(pi, var, G_VARIANT_TYPE_BOOLEAN))
+		return NULL;
+
+	return json_object_new_boolean(g_variant_get_boolean(var));
+}
+
+#define PROPERTY_INT_CONVERTER(_type, _gtype, _get) \
+json_object *property_dbus2json_##_type(const struct property_info *pi, \
+		GVariant *var) \
+{ \
+	if (!property_type_check(pi, var, _gtype)) \
+		return NULL; \
+\
+	return json_object_new_int64(_get(var)); \
+}
+
+PROPERTY_INT_CONVERTER(n, G_VARIANT_TYPE_INT16, g_variant_get_int16)
+PROPERTY_INT_CONVERTER(q, G_VARIANT_TYPE_UINT16, g_variant_get_uint16)
+PROPERTY_INT_CONVERTER(u, G_VARIANT_TYPE_UINT32, g_variant_get_uint32)
+
+#define PROPERTY_STRING_CONVERTER(_type, _gtype) \
+json_object *property_dbus2json_##_type(const struct property_info *pi, \
+		GVariant *var) \
+{ \
+	if (!property_type_check(pi, var, _gtype)) \
+		return NULL; \
+\
+	return json_object_new_string(g_variant_get_string(var, NULL)); \
+}
+
+PROPERTY_STRING_CONVERTER(s, G_VARIANT_TYPE_STRING)
+PROPERTY_STRING_CONVERTER(o, G_VARIANT_TYPE_OBJECT_PATH)
+
+json_object *property_dbus2json_as(const struct property_info *pi,
+		GVariant *var)
+{
+	json_object *jarray;
+	GVariantIter iter;
+	const gchar *s;
+
+	if (!property_type_check(pi, var, G_VARIANT_TYPE_STRING_ARRAY))
+		return NULL;
+
+	jarray = json_object_new_array();
+	g_variant_iter_init(&iter, var);
+	while (g_variant_iter_next(&iter, "&s", &s))
+		json_object_array_add(jarray, json_object_new_string(s));
+
+	return jarray;
+}
+
+/* the sub property of a dict entry, NULL if not handled */
+static const struct property_info *property_dict_entry(
+		const struct property_info *pi, const gchar *key)
+{
+	const struct property_info *pi_sub;
+	gboolean is_config;
+
+	pi_sub = property_by_dbus_name(pi->sub, key, &is_config);
+	if (pi_sub && !is_config)
+		return pi_sub;
+
+	AFB_INFO("Unhandled %s/%s property", pi->name, key);
+	return NULL;
+}
+
+json_object *property_dbus2json_dict(const struct property_info *pi,
+		GVariant *var)
+{
+	const struct property_info *pi_sub;
+	gboolean is_config;
+	GVariantIter iter;
+	json_object *jobj;
+	const gchar *key;
+	GVariant *value;
+
+	if (!property_type_check(pi, var, G_VARIANT_TYPE_VARDICT))
+		return NULL;
+
+	jobj = json_object_new_object();
+	g_variant_iter_init(&iter, var);
+	while (g_variant_iter_next(&iter, "{&sv}", &key, &value)) {
+		pi_sub = property_dict_entry(pi, key);
+		if (pi_sub) {
+			is_config = FALSE;
+			root_property_dbus2json(jobj, pi_sub, NULL, value,
+					&is_config);
+		}
+		g_variant_unref(value);
+	}
+
+	return jobj;
+}
+
 json_object *property_dbus2json(
 		const struct property_info **pip,
 		const gchar *key, GVariant *var,
@@ -352,13 +571,15 @@ json_object *property_dbus2json(
 		*pip = pi;
 	}
 
+	if (pi->dbus2json)
+		return pi->dbus2json(pi, var);
+
 	fmt = pi->fmt;
 
+	/* no converter, go by the value's own type */
 	obj = simple_gvariant_to_json(var, NULL, FALSE);
-	if (obj) {
-		/* TODO check fmt for matching type */
+	if (obj)
 		return obj;
-	}
 
 	switch (*fmt) {
 	case 'a':	/* array */
@@ -412,22 +633,23 @@ json_object *property_dbus2json(
 
 				sub_key = g_variant_get_string(dict_key, NULL);
 
-				pi_sub = pi->sub;
-				while (pi_sub->name) {
-					if (!g_strcmp0(sub_key, pi_sub->name))
-						break;
-					pi_sub++;
-				}
+				pi_sub = property_by_dbus_name(pi->sub, sub_key,
+						&is_subconfig);
 
-				if (pi_sub->name) {
+				if (pi_sub && !is_subconfig) {
 					pi2 = pi_sub;
 					obji = property_dbus2json(&pi2,
-							sub_key, dict_value,
+							NULL, dict_value,
 							&is_subconfig);
 					if (obji) {
-						json_key = property_name_dbus2json(pi2, FALSE);
-						json_object_object_add(obj, json_key, obji);
-						g_free(json_key);
+						json_key = (gchar *)property_json_name(pi2);
+						if (json_key) {
+							json_object_object_add(obj, json_key, obji);
+						} else {
+							json_key = property_name_dbus2json(pi2, FALSE);
+							json_object_object_add(obj, json_key, obji);
+							g_free(json_key);
+						}
 					}
 				} else
 					AFB_INFO("Unhandled %s/%s property", key, sub_key);
@@ -454,10 +676,17 @@ const struct property_info *property_by_dbus_name(
 		gboolean *is_config)
 {
 	const struct property_info *pit;
+	struct property_index *idx;
 	const gchar *suffix;
 	gchar *tmpname;
 	size_t len;
 
+	idx = property_indexes ?
+		g_hash_table_lookup(property_indexes, pi) : NULL;
+	if (idx)
+		return property_index_find(idx->by_dbus_name, dbus_name,
+				".Configuration", is_config);
+
 	/* direct match first */
 	pit = pi;
 	while (pit->name) {
@@ -504,11 +733,18 @@ const struct property_info *property_by_json_name(
 		gboolean *is_config)
 {
 	const struct property_info *pit;
+	struct property_index *idx;
 	gchar *this_json_name;
 	const gchar *suffix;
 	gchar *tmpname;
 	size_t len;
 
+	idx = property_indexes ?
+		g_hash_table_lookup(property_indexes, pi) : NULL;
+	if (idx)
+		return property_index_find(idx->by_json_name, json_name,
+				".configuration", is_config);
+
 	/* direct match */
 	pit = pi;
 	while (pit->name) {
@@ -605,6 +841,7 @@ gboolean root_property_dbus2json(
 		const gchar *key, GVariant *var,
 		gboolean *is_config)
 {
+	const gchar *json_name;
 	json_object *obj;
 	gchar *json_key;
 
@@ -614,6 +851,11 @@ gboolean root_property_dbus2json(
 
 	switch (json_object_get_type(jparent)) {
 	case json_type_object:
+		json_name = !*is_config ? property_json_name(pi) : NULL;
+		if (json_name) {
+			json_object_object_add(jparent, json_name, obj);
+			break;
+		}
 		json_key = property_name_dbus2json(pi, *is_config);
 		json_object_object_add(jparent, json_key, obj);
 		g_free(json_key);
@@ -772,8 +1014,8 @@ GVariant *property_json_to_gvariant(
 			if (!item)
 				return NULL;
 
-			dbus_name = property_get_name(pi->sub, key_o);
-			g_assert(dbus_name);	/* can't fail; but check */
+			dbus_name = !is_config ? g_strdup(pi_sub->name) :
+				configuration_dbus_name(pi_sub->name);
 
 			g_variant_builder_add(&builder, pi->fmt, dbus_name, item);
 
@@ -1025,44 +1267,54 @@ json_object *get_named_property(const struct property_info *pi,
 	return jret;
 }
 
+void json_process_bluez_path(json_object *jresp, const struct bluez_path *bp)
+{
+	if (bluez_path_has(bp, BLUEZ_PATH_ADAPTER))
+		json_object_object_add(jresp, "adapter",
+			bluez_path_component_json(bp, BLUEZ_PATH_ADAPTER));
+
+	if (bluez_path_has(bp, BLUEZ_PATH_DEVICE))
+		json_object_object_add(jresp, "device",
+			bluez_path_component_json(bp, BLUEZ_PATH_DEVICE));
+}
+
 void json_process_path(json_object *jresp, const char *path) {
-	gchar *tmp;
+	struct bluez_path bp;
+
+	bluez_path_parse(&bp, path);
+	json_process_bluez_path(jresp, &bp);
+}
 
-	tmp = bluez_return_adapter(path);
-	json_object_object_add(jresp, "adapter", json_object_new_string(tmp));
-	g_free(tmp);
+gchar *bluez_device_path(const char *adapter, const char *device)
+{
+	const char *tmp;
 
-	tmp = bluez_return_device(path);
-	if (tmp) {
-		json_object_object_add(jresp, "device", json_object_new_string(tmp));
-		g_free(tmp);
+	/* Stop the dbus call from segfaulting from special characters */
+	for (tmp = device; *tmp; tmp++) {
+		if (!g_ascii_isalnum(*tmp) && *tmp != '_')
+			return NULL;
 	}
+
+	return g_strconcat("/org/bluez/", adapter, "/", device, NULL);
 }
 
 gchar *return_bluez_path(afb_req_t request) {
 	struct bluetooth_state *ns = bluetooth_get_userdata(request);
 	const char *adapter = afb_req_value(request, "adapter");
-	const char *device, *tmp;
+	const char *device;
+	gchar *path;
 
-	call_work_lock(ns);
-	adapter = adapter ? adapter : ns->default_adapter;
-	call_work_unlock(ns);
+	adapter = adapter ? adapter : bluetooth_get_default_adapter(ns);
 
 	device = afb_req_value(request, "device");
 	if (!device)
 		return NULL;
 
-	tmp = device;
+	path = bluez_device_path(adapter, device);
+	if (!path)
+		afb_req_fail(request, "failed", "Invalid device parameter");
 
-	/* Stop the dbus call from segfaulting from special characters */
-	for (; *tmp; tmp++) {
-		if (!g_ascii_isalnum(*tmp) && *tmp != '_') {
-			afb_req_fail(request, "failed", "Invalid device parameter");
-			return NULL;
-		}
-	}
-
-	return g_strconcat("/org/bluez/", adapter, "/", device, NULL);
+	return path;
 }
 
 gchar **json_array_to_strv(json_object *jobj)
@@ -42,6 +42,17 @@ _AFT.testVerbStatusSuccess('testBtManagedObjsSuccess','Bluetooth-Manager','manag
 -- Adapter state test
 _AFT.testVerbStatusSuccess('testBtAdpStateSuccess','Bluetooth-Manager','adapter_state', {})
 
+-- Pending operations test
+_AFT.testVerbStatusSuccess('testBtCancelListSuccess','Bluetooth-Manager','cancel', {})
+
+-- Set properties validation tests - rejected before anything is sent to BlueZ
+_AFT.testVerbStatusError('testBtSetPropertiesUnknownError', 'Bluetooth-Manager', 'set_properties', {properties={bogus=true}})
+_AFT.testVerbStatusError('testBtSetPropertiesTypeError', 'Bluetooth-Manager', 'set_properties', {properties={powered="yes"}})
+_AFT.testVerbStatusError('testBtSetPropertiesAdapterError', 'Bluetooth-Manager', 'set_properties', {adapter="hci 0", properties={powered=true}})
+
+-- Set properties test - requires a known device
+-- _AFT.testVerbStatusSuccess('testBtSetPropertiesSuccess', 'Bluetooth-Manager', 'set_properties', {device="dev_01_23_45_67_89_0A", properties={trusted=true}})
+
 -- Pair test - requires valid bluetooth adapter 
 -- _AFT.testVerbStatusSuccess('testBtPairSuccess','Bluetooth-Manager','pair', {device="dev_01_23_45_67_89_0A"})
 
@@ -50,3 +61,11 @@ _AFT.testVerbStatusSuccess('testBtAdpStateSuccess','Bluetooth-Manager','adapter_
 
 -- Connect to a paired device
 -- _AFT.testVerbStatusSuccess('testBtConnectSuccess', 'Bluetooth-Manager', 'connect', {device="dev_01_23_45_67_89_0A"})
+
+-- Connect devices validation tests - rejected before anything is connected
+_AFT.testVerbStatusError('testBtConnectDevicesEmptyError', 'Bluetooth-Manager', 'connect_devices', {devices="[]"})
+_AFT.testVerbStatusError('testBtConnectDevicesEntryError', 'Bluetooth-Manager', 'connect_devices', {devices={{uuid="0000110a-0000-1000-8000-00805f9b34fb"}}})
+_AFT.testVerbStatusError('testBtConnectDevicesConcurrencyError', 'Bluetooth-Manager', 'connect_devices', {devices={"dev_01_23_45_67_89_0A"}, concurrency=9})
+
+-- Connect to several paired devices
+-- _AFT.testVerbStatusSuccess('testBtConnectDevicesSuccess', 'Bluetooth-Manager', 'connect_devices', {devices={"dev_01_23_45_67_89_0A"}})